@@ -62,6 +62,28 @@
 #define REX_MEMSET memset
 #endif
 
+#ifndef REX_MEMCHR
+#include <string.h>
+#define REX_MEMCHR memchr
+#endif
+
+/* The SIMD scanners are built for x86 with GCC or Clang and pick SSSE3
+ * or AVX2 at run time, define REX_NO_SIMD to leave them out */
+#if !defined(REX_NO_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define REX_SIMD_X86
+#endif
+
+/* The VM hands short strings to the bit-state backtracker when it fits in
+ * the VM memory, define REX_NO_BACKTRACK to always run the VM */
+
+/* Define REX_THREADED_DISPATCH to have the VM jump from one instruction
+ * handler to the next through label addresses, GCC and Clang only */
+#if defined(REX_THREADED_DISPATCH) && defined(__GNUC__)
+#define REX_VM_THREADED
+#endif
+
 /* THREAD SAFTEY */
 /* It is unsafe to access any REX_VM object from multiple threads concurrently 
  * In order to practice thread safety each thread will need to own its own REX_VM object 
@@ -94,6 +116,7 @@ struct rex_s
 #define REX_BAD_INSTRUCTION         (3)
 #define REX_ENCODING_ERROR          (4)
 #define REX_BAD_PARAM               (5)
+#define REX_UNSUPPORTED_PROGRAM     (6)
 
 /* TYPES */
 typedef uint32_t rex_instruction_t;
@@ -130,6 +153,7 @@ typedef uint32_t rex_instruction_t;
  * HI           Halt Immediate
  * HNIA         Halt Not Immediate Advance
  * HNI          Halt Not Immediate
+ * HNSA         Halt Not Set Advance
  * HRA          Halt Range Advance
  * HR           Halt Range
  * AWB          Assert Word Boundary
@@ -161,6 +185,7 @@ typedef uint32_t rex_instruction_t;
  * |  | | | | | Range Flag
  * |  | | | | | 
  * |  | | | | Invert Flag
+ * |  | | | | Both flags test a set of the constant pool
  * |  | | | | 
  * |  | | | | Assert:
  * |  | | | | 00
@@ -254,6 +279,20 @@ typedef uint32_t rex_instruction_t;
  */
 #define REX_OPCODE_HNI ( REX_MICROCODE_HALT | REX_MICROCODE_INVERT )
 
+ /*
+ * Halt_Not_Set_Advance HNSA
+ *       ______________________
+ *      |8bit|      24 bit    |
+ *      -----------------------
+ *      | OP |      offset    |
+ *      -----------------------
+ *      If the set at offset in the constant pool does not contain the
+ *      current codepoint halt the thread, see REX SETS
+ *      Advances the character pointer
+ */
+#define REX_OPCODE_HNSA ( REX_MICROCODE_HALT | REX_MICROCODE_INVERT | \
+        REX_MICROCODE_RANGE | REX_MICROCODE_ADVANCE )
+
  /*
  * Halt_Range_Advance HRA
  *       ______________________
@@ -399,6 +438,7 @@ typedef uint32_t rex_instruction_t;
     X(HI, REX_OPCODE_HI)        \
     X(HNIA, REX_OPCODE_HNIA)    \
     X(HNI, REX_OPCODE_HNI)      \
+    X(HNSA, REX_OPCODE_HNSA)    \
     X(HRA, REX_OPCODE_HRA)      \
     X(HR, REX_OPCODE_HR)        \
     X(AWB, REX_OPCODE_AWB)      \
@@ -531,6 +571,11 @@ typedef enum rex_token_e rex_token_t;
 #define REX_UTF8_SIGNIFICANT_BITMASK(leading_ones)      (0xFF >> (leading_ones))
 #define REX_UTF8_TAIL_BYTE_LEADING_BITMASK              (0xC0)
 #define REX_UTF8_BYTE_MOST_SIGNIFICANT_BIT              (0x80)
+#define REX_UTF8_IS_TAIL(c)                             \
+    (((c) & REX_UTF8_TAIL_BYTE_LEADING_BITMASK) ==      \
+        REX_UTF8_BYTE_MOST_SIGNIFICANT_BIT)
+/* Largest codepoint four bytes can encode */
+#define REX_UTF8_CODEPOINT_MAX                          (0x1FFFFF)
 /* UTF8 Parsing
  * Returns production length
  * Arguments:
@@ -589,6 +634,75 @@ rex_parse_utf8_codepoint(
     return l;
 }
 
+/* 
+ * Parses the codepoint ending right before i_str[i_pos]
+ * Bytes before i_str[i_floor] are not read
+ * Returns the codepoint length or 0 if it is not valid
+ */
+static inline size_t
+rex_parse_utf8_codepoint_reverse(
+    const char * const i_str,
+    const size_t i_pos,
+    const size_t i_floor,
+    uint32_t * const o_cp
+){
+    const unsigned char * const u_str = (const unsigned char * const) i_str;
+    size_t l;
+    if (i_pos <= i_floor) return 0;
+    for (l = 1; l < REX_UTF8_MULTIBYTE_MAX && l < i_pos - i_floor; l++)
+        if (
+            (u_str[i_pos - l] & REX_UTF8_TAIL_BYTE_LEADING_BITMASK) != 
+            REX_UTF8_BYTE_MOST_SIGNIFICANT_BIT
+        ) break;
+    return rex_parse_utf8_codepoint(i_str + i_pos - l, l, o_cp) == l ? l : 0;
+}
+
+/* 
+ * Writes the UTF-8 encoding of i_cp to o_str
+ * Returns the length or 0 for NUL and codepoints too long to be parsed
+ */
+static inline size_t
+rex_encode_utf8_codepoint(
+    const uint32_t i_cp,
+    uint8_t o_str[REX_UTF8_MULTIBYTE_MAX]
+){
+    size_t l, i;
+    if (i_cp == 0 || i_cp > REX_UTF8_CODEPOINT_MAX) return 0;
+    l = i_cp < 0x80 ? 1 : i_cp < 0x800 ? 2 : i_cp < 0x10000 ? 3 : 4;
+    /* Leading byte then 6 bits per tail byte */
+    o_str[0] = l == 1 ? i_cp : 
+        (uint8_t)(0xF0 << (4 - l)) | (i_cp >> (6 * (l - 1)));
+    for (i = 1; i < l; i++)
+        o_str[i] = 0x80 | ((i_cp >> (6 * (l - 1 - i))) & 0x3F);
+    return l;
+}
+
+/* 
+ * Returns the end of the largest range starting at i_r0 and ending at or
+ * before i_r1 whose encodings are a range of bytes at every position,
+ * as in [E0-EF][80-BF][80-BF]
+ */
+static inline uint32_t
+rex_utf8_block(
+    const uint32_t i_r0,
+    const uint32_t i_r1
+){
+    static const uint32_t length_max[4] = {0x7F, 0x7FF, 0xFFFF, 0x1FFFFF};
+    uint32_t r1, m;
+    size_t l, i;
+
+    for (l = 0; i_r0 > length_max[l]; l++);
+    r1 = i_r1 < length_max[l] ? i_r1 : length_max[l];
+    for (i = 1; i <= l; i++)
+    {
+        m = ((uint32_t)1 << (6 * i)) - 1;
+        if ((i_r0 & ~m) == (r1 & ~m)) continue;
+        if (i_r0 & m) r1 = i_r0 | m;
+        else if ((r1 & m) != m) r1 = (r1 & ~m) - 1;
+    }
+    return r1;
+}
+
 static inline size_t
 rex_parse_hex_digit(
     const char * const i_str,
@@ -1506,7 +1620,7 @@ rex_ast_count(
         return 1;
     default:
         if (!leaves) return 0;
-        j = rex_parse_charset((const char *) i_ast+i, SIZE_MAX);
+        j = rex_parse_charset((const char *) i_ast+i, i_max_sz - i);
         if (!j) return 0;
         sz += j;
         leaves--;
@@ -1576,11 +1690,16 @@ rex_ast_insert(
     ) return REX_SYNTAX_ERROR;
 
 
+/* 
+ * i_reverse emits a program for the reversed language
+ * Concatenations are emitted right to left and submatches are dropped
+ */
 static inline int
-rex_ast_compile(
+rex_ast_compile_direction(
     rex_compiler_t *io_compiler,
     uint32_t *o_prog,
-    size_t i_prog_sz
+    size_t i_prog_sz,
+    const int i_reverse
 )
 {
     uint8_t * const ast_floor = io_compiler->memory + io_compiler->memory_sz;
@@ -1612,7 +1731,8 @@ rex_ast_compile(
 
         case REX_TOKEN_LPAREN:
             io_compiler->ast_top++;
-            if (o_prog) o_prog[pi++] = REX_INSTRUCTION(REX_OPCODE_SS, mi);
+            if (o_prog && !i_reverse) 
+                o_prog[pi++] = REX_INSTRUCTION(REX_OPCODE_SS, mi);
             mi++;
             REX_AST_PUSH_PRIMITIVE(io_compiler, uint8_t, REX_TOKEN_SUBMATCH_STAGE_1);
             r = rex_ast_rot(io_compiler);
@@ -1635,6 +1755,8 @@ rex_ast_compile(
 
         case REX_TOKEN_CONCAT:
             io_compiler->ast_top++;
+            /* The right operand is first in the tree */
+            if (i_reverse) break;
             r = rex_ast_rot(io_compiler);
             if (r) return r;
             break;
@@ -1671,7 +1793,8 @@ rex_ast_compile(
 
         case REX_TOKEN_SUBMATCH_STAGE_1:
             io_compiler->ast_top++;
-            if (o_prog) o_prog[pi++] = REX_INSTRUCTION(REX_OPCODE_SS, mi);
+            if (o_prog && !i_reverse) 
+                o_prog[pi++] = REX_INSTRUCTION(REX_OPCODE_SS, mi);
             mi++;
             break;
             
@@ -1756,496 +1879,6492 @@ rex_ast_compile(
     return 0; 
 }
 
+static inline int
+rex_ast_compile(
+    rex_compiler_t *io_compiler,
+    uint32_t *o_prog,
+    size_t i_prog_sz
+)
+{
+    return rex_ast_compile_direction(io_compiler, o_prog, i_prog_sz, 0);
+}
 
-/* REX VIRTUAL MACHINE */
-typedef struct rex_match_s rex_match_t;
-typedef struct rex_vm_s rex_vm_t;
-typedef struct rex_vm_threadlist_s rex_vm_threadlist_t;
-
-/* Thread Memory Layout
- *
- * uint32_t : pc
- * const char *[N*2] : match markers
- *
+/* 
+ * Compiles a program that matches the reversed strings of the pattern
+ * for rex_vm_reverse to find where a match starts from where it ends
+ * Assertions keep their meaning as they are checked at absolute positions
  */
-
-struct rex_match_s
+static inline int
+rex_ast_compile_reverse(
+    rex_compiler_t *io_compiler,
+    uint32_t *o_prog,
+    size_t i_prog_sz
+)
 {
-    const char * match;
-    size_t match_sz;
-};
+    return rex_ast_compile_direction(io_compiler, o_prog, i_prog_sz, 1);
+}
 
-struct rex_vm_threadlist_s
+
+/* REX SIMD */
+
+#define REX_SIMD_NONE  (0)
+#define REX_SIMD_SSSE3 (1)
+#define REX_SIMD_AVX2  (2)
+/* Bytes checked for the terminator before they are scanned as ASCII */
+#define REX_ASCII_WINDOW (256)
+
+/* Returns the widest instruction set the scanners can use */
+static inline int
+rex_simd_level(void)
 {
-    void * buffer;
-    size_t thread_count;
-    size_t marker_count;
-};
+#ifdef REX_SIMD_X86
+    /* Probed by the first call, threads racing to it store the same level */
+    static int probed = -1;
+    int level = __atomic_load_n(&probed, __ATOMIC_RELAXED);
+    if (level >= 0) return level;
+    __builtin_cpu_init();
+    level = __builtin_cpu_supports("avx2") ? REX_SIMD_AVX2 :
+        __builtin_cpu_supports("ssse3") ? REX_SIMD_SSSE3 : REX_SIMD_NONE;
+    __atomic_store_n(&probed, level, __ATOMIC_RELAXED);
+    return level;
+#else
+    return REX_SIMD_NONE;
+#endif
+}
 
-#define REX_MARKERS(thread) ((const char **) (((uint32_t*) thread) + 1))
+#ifdef REX_SIMD_X86
+/* Returns the first position before i_end with the high bit set or i_end */
+__attribute__((target("sse2")))
+static size_t
+rex_ascii_scan_sse2(
+    const uint8_t * const i_str,
+    size_t i_pos,
+    const size_t i_end
+){
+    unsigned int mask;
+    for (; i_pos + 16 <= i_end; i_pos += 16)
+    {
+        mask = _mm_movemask_epi8(
+            _mm_loadu_si128((const __m128i *) (i_str + i_pos)));
+        if (mask) return i_pos + __builtin_ctz(mask);
+    }
+    for (; i_pos < i_end && i_str[i_pos] < 0x80; i_pos++);
+    return i_pos;
+}
 
-void *
-rex_vm_thread_by_index(
-    const rex_vm_threadlist_t * const i_threadlist,
-    const size_t i_thread_index
+/* The same as rex_ascii_scan_sse2 in blocks of 32 */
+__attribute__((target("avx2")))
+static size_t
+rex_ascii_scan_avx2(
+    const uint8_t * const i_str,
+    size_t i_pos,
+    const size_t i_end
 ){
-    uint8_t * const byte_buffer = i_threadlist->buffer;
-    return byte_buffer +  i_thread_index *
-        (sizeof(uint32_t) + sizeof(char*) * i_threadlist->marker_count);
+    unsigned int mask;
+    for (; i_pos + 32 <= i_end; i_pos += 32)
+    {
+        mask = _mm256_movemask_epi8(
+            _mm256_loadu_si256((const __m256i *) (i_str + i_pos)));
+        if (mask) return i_pos + __builtin_ctz(mask);
+    }
+    return rex_ascii_scan_sse2(i_str, i_pos, i_end);
 }
+#endif
 
-/* NO BOUNDS CHECKING!!! */
-void
-rex_vm_threadlist_insert(
-    rex_vm_threadlist_t *i_threadlist,
-    const char ** i_markers,
-    uint32_t i_pc,
-    size_t i_index
-)
-{
-    size_t i;
-    uint32_t *pc;
-    uint8_t * thread;
-    char ** o_markers;
-    size_t thread_sz = 
-        sizeof(uint32_t) + sizeof(char *) * i_threadlist->marker_count;
-    for (i = 0; i<i_index; i++)
-    {
-        pc = rex_vm_thread_by_index(i_threadlist, i);
-        if (*pc  == i_pc) return;
-    }
-    pc = rex_vm_thread_by_index(i_threadlist, i);
-    thread = (uint8_t *) pc;
-    memmove(
-            thread + thread_sz,
-            thread,
-            (i_threadlist->thread_count - i) * thread_sz
-           );
-    *pc = i_pc;
-    pc++;
-    o_markers = (char **) pc;
-    memcpy(
-            o_markers,
-            i_markers,
-            sizeof(char *) * i_threadlist->marker_count
-          );
-    i_threadlist->thread_count++;
-}
-
-void
-rex_vm_threadlist_push(
-    rex_vm_threadlist_t *i_threadlist,
-    const char ** i_markers,
-    uint32_t i_pc
-)
-{
-    size_t i;
-    uint32_t *pc;
-    for (i = 0; i<i_threadlist->thread_count; i++)
-    {
-        pc = rex_vm_thread_by_index(i_threadlist, i);
-        if (*pc  == i_pc) return;
-    }
-    pc = rex_vm_thread_by_index(i_threadlist, i);
-    *pc = i_pc;
-    memcpy(
-        pc+1,
-        i_markers,
-        sizeof(char *) * i_threadlist->marker_count
-    );
-    i_threadlist->thread_count++;
+/*
+ * Returns how many of the i_window bytes from i_pos on come before the
+ * terminator and the end of the string
+ * memchr may read all the bytes it is given, so a string of size SIZE_MAX
+ * is looked at a byte at a time up to its terminator
+ */
+static inline size_t
+rex_string_window(
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_pos,
+    const size_t i_window
+){
+    const char * nul;
+    size_t n;
+
+    if (i_string_sz == SIZE_MAX)
+    {
+        for (n = 0; n < i_window && i_string[i_pos + n]; n++);
+        return n;
+    }
+    n = REX_MIN(i_string_sz - i_pos, i_window);
+    nul = REX_MEMCHR(i_string + i_pos, 0, n);
+    return nul ? (size_t) (nul - (i_string + i_pos)) : n;
 }
 
-void
-rex_vm_thread_expand(
-    rex_vm_threadlist_t *i_threadlist,
-    size_t i_start,
-    const rex_instruction_t * const i_prog,
-    const char * str_pos
+/*
+ * Returns how many bytes from i_pos on are ASCII codepoints other than
+ * the terminator, looking at REX_ASCII_WINDOW bytes at most
+ * These decode to themselves so the UTF-8 decoder can be skipped
+ *
+ * io_checked, NULLABLE, is where the bytes from i_pos on stop being known
+ * to hold no terminator. Past it a window is checked and it is moved to
+ * the end of that window, so text where ASCII and other codepoints mix
+ * has each byte checked once instead of a window for every run.
+ */
+static inline size_t
+rex_ascii_run(
+    const int i_simd,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_pos,
+    size_t * const io_checked
+){
+    const uint8_t * const str = (const uint8_t *) i_string;
+    size_t n, i;
 
-)
-{
-    uint32_t *pc;
-    uint32_t pc_tmp;
-    uint32_t inst;
-    uint8_t op;
-    void * thread;
-    size_t i;
-    uint32_t mi;
-   
-    for (i = i_start;i < i_threadlist->thread_count;){
-        thread = (uint32_t*) rex_vm_thread_by_index(i_threadlist, i);
-        pc = thread;
-        inst = i_prog[*pc];
-        op = REX_OP_FROM_INST(inst);
-        switch (op){
-        case REX_OPCODE_J:
-            *pc = REX_IMM_FROM_INST(inst);
-            break;
-        case REX_OPCODE_B:
-            pc_tmp = *pc;
-            /* Inc pc for first thread*/
-            pc[0]++;
-            /* Insert new thread pointing to jump*/
-            rex_vm_threadlist_insert(
-                i_threadlist,
-                REX_MARKERS(thread),
-                REX_IMM_FROM_INST(inst),
-                i+1
-            );
-            break;
-        case REX_OPCODE_BWP:
-            pc_tmp = *pc;
-            /* set first thread pc to jump*/
-            *pc = REX_IMM_FROM_INST(inst);
-            /* Insert new thread with incremented thread pc*/
-            rex_vm_threadlist_insert(
-                i_threadlist,
-                REX_MARKERS(thread),
-                pc_tmp + 1,
-                i + 1
-            );
-            break;
-        /* TODO:
-         * REFACTOR: Reconcile the handling on anchors with this 
-         * Move SS to vm func or move anchors here 
-         * or decide this is fine and leave a comment
-         * Anchors are failable unlike everything here
-         * also require start and stop information
-         * and string length*/
-        case REX_OPCODE_SS:
-            mi = REX_IMM_FROM_INST(inst);
-            if (mi < i_threadlist->marker_count)
-                REX_MARKERS(thread)[mi] = str_pos;
-            pc[0]++;
-            break;
-        default:
-            i++;
-            break;
-        }
+    if (i_pos >= i_string_sz) return 0;
+    if (io_checked && *io_checked > i_pos)
+        n = REX_MIN(*io_checked - i_pos, REX_ASCII_WINDOW);
+    else
+    {
+        n = rex_string_window(i_string, i_string_sz, i_pos, REX_ASCII_WINDOW);
+        if (io_checked) *io_checked = i_pos + n;
     }
+#ifdef REX_SIMD_X86
+    if (i_simd == REX_SIMD_AVX2)
+        return rex_ascii_scan_avx2(str, i_pos, i_pos + n) - i_pos;
+    if (i_simd == REX_SIMD_SSSE3)
+        return rex_ascii_scan_sse2(str, i_pos, i_pos + n) - i_pos;
+#endif
+    for (i = 0; i < n && str[i_pos + i] < 0x80; i++);
+    return i;
 }
 
 
+/* REX LITERALS */
 
-struct rex_vm_s
+/*
+ * Most patterns contain a fixed string every match has to contain.
+ * An unanchored search only needs to start threads where that string can
+ * still be reached, so the positions in between are skipped with memchr
+ * instead of being run.
+ *
+ * Literals are taken from the compiled program as rex_ast_compile consumes
+ * the AST. A run of HNIA instructions is executed in order once its first
+ * instruction is, so if every path from pc 0 to M goes through that first
+ * instruction the codepoints the run accepts are required. SS only moves a
+ * marker and is skipped.
+ *
+ * Literals are compared as UTF-8 bytes so a search skipping to them assumes
+ * the string is valid UTF-8 between candidates.
+ */
+typedef struct rex_literal_s rex_literal_t;
+
+#define REX_LITERAL_MAX (32)
+
+struct rex_literal_s
 {
-    void * memory;
-    size_t memory_sz;
-    const char * string;
-    size_t string_sz;
-    size_t string_start;
-    const rex_instruction_t * prog;
-    size_t prog_sz;
-    rex_match_t * matches;
-    size_t matches_sz;
-    rex_vm_threadlist_t clist, nlist;
-    size_t thread_sz;
-    size_t cpi, l, ti, mi;
-    uint32_t  pc;
-    uint32_t cp, rcp1;
-    uint8_t prev_word;
-    void * cthread;
-    int match;
-    int halted;
+    size_t sz;
+    /* Index of the byte memchr looks for */
+    size_t rare;
+    /* Most codepoints a match has before the literal, SIZE_MAX if unbounded */
+    size_t lead;
+    char str[REX_LITERAL_MAX];
 };
 
-static int
-rex_vm_exec_thread(
-    rex_vm_t * io_vm
+/* Bytes searched for a null terminator at a time */
+#define REX_LITERAL_WINDOW (4096)
+
+/* A literal prefix is a literal with no lead, the names are kept for the
+ * callers of rex_prog_prefix and rex_vm_search_prefix */
+typedef rex_literal_t rex_prefix_t;
+
+#define REX_PREFIX_MAX REX_LITERAL_MAX
+#define REX_PREFIX_WINDOW REX_LITERAL_WINDOW
+
+/* Generated by byte_rank.py over C headers, Python sources and English text
+ * 0 is the rarest byte */
+static const uint8_t rex_byte_rank[256] =
+{
+      0,   1,   2,   3,   4,   5,   6,   7,   8, 203, 246,   9, 115,  10,  11,  12,
+     13,  14,  15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25,  26,  27,  28,
+    255, 161, 227, 205, 162, 166, 163, 243, 232, 231, 230, 185, 241, 228, 229, 217,
+    208, 202, 199, 197, 183, 173, 187, 168, 174, 175, 206, 192, 178, 210, 181, 179,
+    160, 216, 190, 214, 204, 225, 198, 193, 191, 215, 159, 176, 212, 200, 218, 209,
+    207, 165, 219, 222, 224, 201, 177, 188, 184, 172, 182, 196, 213, 195, 164, 240,
+    167, 249, 233, 244, 242, 254, 235, 234, 237, 252, 180, 211, 245, 236, 250, 248,
+    238, 189, 251, 247, 253, 239, 221, 223, 220, 226, 186, 170, 194, 169, 171,  29,
+    157, 131, 152, 130,  88,  93, 138, 128, 143, 142, 135, 144, 107, 140,  78,  95,
+    113,  89,  81,  85, 156,  98,  82, 104, 141, 139,  83,  96, 105,  91,  79, 132,
+    103, 101,  77, 111, 129, 121,  87, 116, 125, 148, 146, 137, 124,  97, 153, 147,
+    136,  94,  99, 100, 118, 126, 110, 102, 134,  92, 114, 133, 108, 119, 123, 112,
+     30,  31, 149, 150,  84,  80,  64,  32,  66,  33,  69,  67,  34,  35,  72,  65,
+    155, 151,  36,  37,  38,  39,  40, 122,  90,  86,  41,  42,  43,  44,  45,  46,
+    154, 120, 158, 117,  76, 109,  74,  75,  70,  73,  71, 145, 127, 106,  47,  68,
+     48,  49,  50,  51,  52,  53,  54,  55,  56,  57,  58,  59,  60,  61,  62,  63
+};
+
+/* Appends the UTF-8 encoding of i_cp, returns 0 if it does not fit */
+static inline int
+rex_literal_append(
+    rex_literal_t * const io_literal,
+    const uint32_t i_cp
 ){
-    
-    rex_instruction_t inst;
-    uint32_t imm;
-    io_vm->cthread = rex_vm_thread_by_index(&io_vm->clist, io_vm->ti);
-    io_vm->pc = *(uint32_t*) io_vm->cthread;
+    uint8_t str[REX_UTF8_MULTIBYTE_MAX];
+    const size_t l = rex_encode_utf8_codepoint(i_cp, str);
+    /* NUL is never matched and longer codepoints are never parsed */
+    if (l == 0 || io_literal->sz + l > REX_LITERAL_MAX) return 0;
+    REX_MEMCPY(io_literal->str + io_literal->sz, str, l);
+    io_literal->sz += l;
+    return 1;
+}
 
-/* Some instruction sequences are handled
- * as if they were a single instruction
+/* 
+ * Fills io_literal with the codepoints of the HNIA run at i_pc
+ * and picks its rarest byte
  */
-thread_continue:
-    inst = io_vm->prog[io_vm->pc];
+static inline void
+rex_literal_from_run(
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    size_t i_pc,
+    rex_literal_t * const io_literal
+){
+    const uint8_t * const str = (const uint8_t *) io_literal->str;
+    size_t i;
+    io_literal->sz = 0;
+    io_literal->rare = 0;
+    for (; i_pc < i_prog_sz; i_pc++)
+    {
+        if (REX_OP_FROM_INST(i_prog[i_pc]) == REX_OPCODE_SS) continue;
+        if (REX_OP_FROM_INST(i_prog[i_pc]) != REX_OPCODE_HNIA) break;
+        if (!rex_literal_append(io_literal, REX_IMM_FROM_INST(i_prog[i_pc])))
+            break;
+    }
+    for (i = 1; i < io_literal->sz; i++)
+        if (rex_byte_rank[str[i]] < rex_byte_rank[str[io_literal->rare]])
+            io_literal->rare = i;
+}
 
-    imm = REX_IMM_FROM_INST(inst);
+/* 
+ * Extracts the literal prefix of a program into o_literal
+ * A program without one gets a literal of size 0
+ */
+static inline int
+rex_prog_prefix(
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_literal_t * const o_literal
+){
+    if (!i_prog || !o_literal) return REX_BAD_PARAM;
+    rex_literal_from_run(i_prog, i_prog_sz, 0, o_literal);
+    o_literal->lead = 0;
+    return REX_SUCESS;
+}
+
+/* Returns the successors of i_pc in o_next ignoring halts */
+static inline size_t
+rex_prog_successors(
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    const uint32_t i_pc,
+    uint32_t o_next[2]
+){
+    const rex_instruction_t inst = i_prog[i_pc];
+    size_t n = 0;
     switch (REX_OP_FROM_INST(inst))
     {
-    case REX_OPCODE_HI:
-        if (io_vm->cp == imm) break;
-        io_vm->pc++;
-        goto thread_continue;
-    case REX_OPCODE_HIA:
-        if (io_vm->cp == imm) break;
-        rex_vm_threadlist_push(
-            &io_vm->nlist, 
-            REX_MARKERS(io_vm->cthread),
-            io_vm->pc + 1); 
-        rex_vm_thread_expand(
-            &io_vm->nlist, 
-            io_vm->nlist.thread_count - 1,
-            io_vm->prog,
-            io_vm->string + io_vm->cpi + io_vm->l
-        );
-        break;
-    case REX_OPCODE_HNI:
-        if (io_vm->cp != imm) break;
-        io_vm->pc++;
-        goto thread_continue;
-    case REX_OPCODE_HNIA:
-        if (io_vm->cp != imm) break;
-        rex_vm_threadlist_push(
-            &io_vm->nlist, 
-            REX_MARKERS(io_vm->cthread),
-            io_vm->pc + 1); 
-        rex_vm_thread_expand(
-            &io_vm->nlist, 
-            io_vm->nlist.thread_count - 1,
-            io_vm->prog,
-            io_vm->string + io_vm->cpi + io_vm->l
-        );
-        break;
-    case REX_OPCODE_HR:
-        if (io_vm->cp >= imm && io_vm->cp <= io_vm->rcp1) break;
-        io_vm->pc++;
-        goto thread_continue;
-    case REX_OPCODE_HRA:
-        if (io_vm->cp >= imm && io_vm->cp <= io_vm->rcp1) break;
-        rex_vm_threadlist_push(
-            &io_vm->nlist, 
-            REX_MARKERS(io_vm->cthread),
-            io_vm->pc + 1); 
-        rex_vm_thread_expand(
-            &io_vm->nlist, 
-            io_vm->nlist.thread_count - 1,
-            io_vm->prog,
-            io_vm->string + io_vm->cpi + io_vm->l
-        );
+    case REX_OPCODE_M:
+        return 0;
+    case REX_OPCODE_J:
+        o_next[n++] = REX_IMM_FROM_INST(inst);
         break;
-    case REX_OPCODE_AWB:
-        if (io_vm->prev_word == REX_ISWORD(io_vm->cp)) break;
-        io_vm->pc = ++*(uint32_t *)io_vm->cthread;
-        rex_vm_thread_expand(
-            &io_vm->clist, 
-           io_vm->ti,
-            io_vm->prog,
-            io_vm->string + io_vm->cpi + io_vm->l
-        );
-        goto thread_continue;
-    case REX_OPCODE_ANWB:
-        if (io_vm->prev_word != REX_ISWORD(io_vm->cp)) break;
-        io_vm->pc = ++*(uint32_t *)io_vm->cthread;
-        rex_vm_thread_expand(
-            &io_vm->clist, 
-           io_vm->ti,
-            io_vm->prog,
-            io_vm->string + io_vm->cpi + io_vm->l
-        );
-        goto thread_continue;
-    case REX_OPCODE_AE:
-        if (io_vm->string_sz - io_vm->cpi != 0)
-            if (io_vm->string[io_vm->cpi] != 0)
-                break;
-        io_vm->pc = ++*(uint32_t *)io_vm->cthread;
-        rex_vm_thread_expand(
-            &io_vm->clist, 
-           io_vm->ti,
-            io_vm->prog,
-            io_vm->string + io_vm->cpi + io_vm->l
-        );
-        goto thread_continue;
-    case REX_OPCODE_AS:
-        if (io_vm->cpi != 0) break;
-        io_vm->pc = ++*(uint32_t *)io_vm->cthread;
-        rex_vm_thread_expand(
-            &io_vm->clist, 
-           io_vm->ti,
-            io_vm->prog,
-            io_vm->string + io_vm->cpi + io_vm->l
-        );
-        goto thread_continue;
-    case REX_OPCODE_LR:
-        io_vm->rcp1 = imm;
-        io_vm->pc++;
-        goto thread_continue;
-    case REX_OPCODE_SS:
     case REX_OPCODE_B:
     case REX_OPCODE_BWP:
-    case REX_OPCODE_J:
-        /* Handled by thread expand */
-        /*FALLTHROUGH*/
+        o_next[n++] = REX_IMM_FROM_INST(inst);
+        /* FALLTHROUGH */
     default:
-        return REX_BAD_INSTRUCTION;
+        o_next[n++] = i_pc + 1;
+        break;
+    }
+    if (n == 2 && o_next[1] >= i_prog_sz) n--;
+    if (n && o_next[0] >= i_prog_sz) o_next[0] = o_next[--n];
+    return n;
+}
+
+/* Worst case memory_sz of rex_prog_literal */
+#define REX_PROG_LITERAL_MEMORY_SZ(prog_sz) \
+    ((prog_sz) * (sizeof(size_t) + sizeof(uint32_t) * 2 + 1))
+
+#define REX_LITERAL_REACHED     (1)
+
+/* 
+ * Returns the lead of the literal at i_pc or 0 if a match can avoid i_pc
+ * The lead is stored plus one so SIZE_MAX stays unbounded
+ *
+ * The pcs reached from pc 0 without going through i_pc are marked. If M is
+ * not among them i_pc is required and the longest path to it is found in
+ * topological order. Any cycle is taken as unbounded.
+ */
+static inline size_t
+rex_prog_literal_lead(
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    const uint32_t i_pc,
+    void * const i_memory
+){
+    size_t * const lead = i_memory;
+    uint32_t * const stack = (uint32_t *)(lead + i_prog_sz);
+    uint32_t * const indegree = stack + i_prog_sz;
+    uint8_t * const flags = (uint8_t *)(indegree + i_prog_sz);
+    uint32_t next[2], pc;
+    size_t sp, i, n, reached, done;
+
+    REX_MEMSET(flags, 0, i_prog_sz);
+    REX_MEMSET(indegree, 0, sizeof(uint32_t) * i_prog_sz);
+    REX_MEMSET(lead, 0, sizeof(size_t) * i_prog_sz);
+    flags[0] = REX_LITERAL_REACHED;
+    stack[0] = 0;
+    reached = 1;
+    for (sp = 1; sp;)
+    {
+        pc = stack[--sp];
+        if (REX_OP_FROM_INST(i_prog[pc]) == REX_OPCODE_M) return 0;
+        if (pc == i_pc) continue;
+        n = rex_prog_successors(i_prog, i_prog_sz, pc, next);
+        for (i = 0; i < n; i++)
+        {
+            indegree[next[i]]++;
+            if (flags[next[i]]) continue;
+            flags[next[i]] = REX_LITERAL_REACHED;
+            stack[sp++] = next[i];
+            reached++;
+        }
+    }
+
+    if (indegree[0]) return SIZE_MAX;
+    stack[0] = 0;
+    done = 0;
+    for (sp = 1; sp;)
+    {
+        pc = stack[--sp];
+        done++;
+        if (pc == i_pc) continue;
+        n = rex_prog_successors(i_prog, i_prog_sz, pc, next);
+        for (i = 0; i < n; i++)
+        {
+            lead[next[i]] = REX_MAX(
+                lead[next[i]],
+                lead[pc] + !!(REX_OP_FROM_INST(i_prog[pc]) & 
+                    REX_MICROCODE_ADVANCE)
+            );
+            if (--indegree[next[i]] == 0) stack[sp++] = next[i];
+        }
+    }
+    return done == reached ? lead[i_pc] + 1 : SIZE_MAX;
+}
+
+/* 
+ * Extracts the required literal of a program with the rarest byte
+ * into o_literal. A program without one gets a literal of size 0
+ * i_memory needs REX_PROG_LITERAL_MEMORY_SZ(i_prog_sz) bytes
+ */
+static inline int
+rex_prog_literal(
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    void * const i_memory,
+    const size_t i_memory_sz,
+    rex_literal_t * const o_literal
+){
+    rex_literal_t run;
+    size_t pc, lead;
+    int better;
+
+    if (!i_prog || !o_literal || !i_memory) return REX_BAD_PARAM;
+    if (REX_PROG_LITERAL_MEMORY_SZ(i_prog_sz) > i_memory_sz)
+        return REX_OUT_OF_MEMORY;
+    o_literal->sz = 0;
+    for (pc = 0; pc < i_prog_sz; pc++)
+    {
+        if (REX_OP_FROM_INST(i_prog[pc]) != REX_OPCODE_HNIA) continue;
+        lead = rex_prog_literal_lead(i_prog, i_prog_sz, pc, i_memory);
+        if (!lead) continue;
+        rex_literal_from_run(i_prog, i_prog_sz, pc, &run);
+        run.lead = lead == SIZE_MAX ? SIZE_MAX : lead - 1;
+        /* The rest of the run is a suffix of this literal */
+        for (; pc + 1 < i_prog_sz; pc++)
+            if (REX_OP_FROM_INST(i_prog[pc + 1]) != REX_OPCODE_HNIA && 
+                REX_OP_FROM_INST(i_prog[pc + 1]) != REX_OPCODE_SS) break;
+        if (!run.sz) continue;
+        if (!o_literal->sz) better = 1;
+        else if (
+            rex_byte_rank[(uint8_t) run.str[run.rare]] != 
+            rex_byte_rank[(uint8_t) o_literal->str[o_literal->rare]]
+        ) better = 
+            rex_byte_rank[(uint8_t) run.str[run.rare]] < 
+            rex_byte_rank[(uint8_t) o_literal->str[o_literal->rare]];
+        /* A bounded lead lets the search skip */
+        else if (run.lead != o_literal->lead) better = run.lead < o_literal->lead;
+        else better = run.sz > o_literal->sz;
+        if (better) *o_literal = run;
+    }
+    return REX_SUCESS;
+}
+
+/* Returns non zero if the literal is at i_string[i_pos] */
+static inline int
+rex_literal_at(
+    const rex_literal_t * const i_literal,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_pos
+){
+    size_t i;
+    /* The literal holds no NUL so the comparison stops at the terminator */
+    for (i = 0; i < i_literal->sz; i++)
+        if (i_pos + i >= i_string_sz || i_string[i_pos + i] != i_literal->str[i])
+            return 0;
+    return 1;
+}
+
+/* 
+ * Returns the first position at or after i_pos the literal is at
+ * or SIZE_MAX if there is none before the end of the string
+ */
+static inline size_t
+rex_literal_find(
+    const rex_literal_t * const i_literal,
+    const char * const i_string,
+    const size_t i_string_sz,
+    size_t i_pos
+){
+    const char rare = i_literal->str[i_literal->rare];
+    const char * hit;
+    size_t n;
+
+    if (i_literal->sz == 0) return i_pos;
+    /* Candidates are found by their rare byte so the bytes before it
+     * are checked for the terminator first */
+    for (n = 0; n < i_literal->rare; n++, i_pos++)
+        if (i_pos >= i_string_sz || !i_string[i_pos]) return SIZE_MAX;
+
+    while (i_pos < i_string_sz)
+    {
+        n = rex_string_window(i_string, i_string_sz, i_pos, 
+            REX_LITERAL_WINDOW);
+        for (
+            hit = REX_MEMCHR(i_string + i_pos, rare, n);
+            hit;
+            hit = REX_MEMCHR(hit + 1, rare, i_string + i_pos + n - hit - 1)
+        )
+            if (rex_literal_at(
+                i_literal,
+                i_string,
+                i_string_sz,
+                hit - i_string - i_literal->rare
+            )) return hit - i_string - i_literal->rare;
+        /* Stopped at the terminator or the end of the string */
+        if (n < REX_LITERAL_WINDOW) break;
+        i_pos += n;
+    }
+    return SIZE_MAX;
+}
+
+/* 
+ * Returns the first position at or after i_pos a match can start at
+ * given i_next, the first position of the literal at or after i_pos
+ * Both are SIZE_MAX if there is none
+ */
+static inline size_t
+rex_literal_restart(
+    const rex_literal_t * const i_literal,
+    const char * const i_string,
+    const size_t i_pos,
+    const size_t i_next
+){
+    size_t pos, n, l;
+    if (i_next == SIZE_MAX) return SIZE_MAX;
+    /* Each codepoint is at least a byte */
+    if (i_literal->lead == SIZE_MAX || i_next - i_pos <= i_literal->lead)
+        return i_pos;
+    pos = i_next;
+    for (n = 0; n < i_literal->lead; n++)
+    {
+        l = rex_parse_utf8_codepoint_reverse(i_string, pos, i_pos, NULL);
+        if (l == 0) break;
+        pos -= l;
+    }
+    return pos;
+}
+
+
+/* REX AHO-CORASICK */
+
+/*
+ * Alternations of literals compile to a tree of B and J with a chain of HNIA
+ * on every arm, which the VM walks at every position. The arms are found by
+ * following every path from pc 0 in priority order and are put in a trie
+ * whose failure transitions are resolved into a table, so the string is
+ * scanned with one lookup per byte.
+ *
+ * When every path is a literal ending in M the automaton is the whole
+ * matcher. Otherwise every path is cut at the first instruction that is not
+ * part of a literal and the automaton finds where a match can start.
+ *
+ * Bytes are mapped to the classes of the bytes in the literals and
+ * the rest share one class.
+ */
+typedef struct rex_aho_corasick_s rex_aho_corasick_t;
+
+/* Leading bytes of the arms compared at every position */
+#define REX_TEDDY_BYTES (3)
+/* Above this many arms the buckets pass too many candidates */
+#define REX_TEDDY_ARMS  (64)
+
+struct rex_aho_corasick_s
+{
+    uint8_t byte_class[256];
+    size_t class_count;
+    /* next[state * class_count + class] */
+    uint32_t * next;
+    /* Highest priority arm ending at a state or REX_AHO_CORASICK_NONE */
+    uint32_t * output;
+    /* Closest state with an output on the failure path */
+    uint32_t * dict;
+    uint32_t * depth;
+    size_t state_count;
+    size_t max_depth;
+    /* The automaton matches the whole program */
+    int whole;
+    /* Nibble masks of the first teddy_sz bytes of the arms, see REX TEDDY */
+    uint8_t teddy_lo[REX_TEDDY_BYTES][16];
+    uint8_t teddy_hi[REX_TEDDY_BYTES][16];
+    size_t teddy_sz;
+    /* Scanner used to find where arms start, REX_SIMD_NONE walks the table */
+    int teddy;
+};
+
+#define REX_AHO_CORASICK_ROOT   (0)
+#define REX_AHO_CORASICK_NONE   (0xFFFFFFFF)
+/* Instructions followed before the program is taken as too branchy */
+#define REX_AHO_CORASICK_WORK(prog_sz) ((prog_sz) * 64 + 64)
+
+/* 
+ * Follows every path from pc 0 and adds the arms to the trie
+ * Without o_sizes the byte classes and io_ac->state_count are already set
+ *
+ * o_sizes[0]: upper bound of the state count
+ * o_sizes[1]: arm count
+ *
+ * Returns REX_UNSUPPORTED_PROGRAM if a path can not be cut after a literal
+ * or if i_whole is set and a path is not only a literal
+ */
+static int
+rex_aho_corasick_walk(
+    rex_aho_corasick_t * const io_ac,
+    uint32_t * const i_stack,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    const int i_whole,
+    size_t * const o_sizes
+){
+    const size_t budget = REX_AHO_CORASICK_WORK(i_prog_sz);
+    uint8_t bytes[REX_UTF8_MULTIBYTE_MAX];
+    size_t sp, work, i, l, arm;
+    uint32_t pc, imm, v, c, * t;
+    int cut;
+
+    if (o_sizes) o_sizes[0] = o_sizes[1] = 0;
+    arm = 0;
+    work = 0;
+    sp = 0;
+    pc = 0;
+    /* v is the literal length while sizing and the trie state otherwise */
+    v = REX_AHO_CORASICK_ROOT;
+    for (;;)
+    {
+        if (++work > budget) return REX_UNSUPPORTED_PROGRAM;
+        if (pc >= i_prog_sz) return REX_BAD_INSTRUCTION;
+        imm = REX_IMM_FROM_INST(i_prog[pc]);
+        cut = 0;
+        switch (REX_OP_FROM_INST(i_prog[pc]))
+        {
+        case REX_OPCODE_SS:
+            pc++;
+            continue;
+        case REX_OPCODE_HNIA:
+            l = rex_encode_utf8_codepoint(imm, bytes);
+            if (l == 0) 
+            {
+                cut = 1;
+                break;
+            }
+            for (i = 0; i < l; i++)
+            {
+                if (o_sizes)
+                {
+                    io_ac->byte_class[bytes[i]] = 1;
+                    v++;
+                    continue;
+                }
+                c = io_ac->byte_class[bytes[i]];
+                t = io_ac->next + v * io_ac->class_count + c;
+                if (*t == REX_AHO_CORASICK_NONE)
+                {
+                    *t = io_ac->state_count++;
+                    io_ac->depth[*t] = io_ac->depth[v] + 1;
+                }
+                v = *t;
+            }
+            pc++;
+            continue;
+        case REX_OPCODE_J:
+            if (imm <= pc) 
+            {
+                cut = 1;
+                break;
+            }
+            pc = imm;
+            continue;
+        case REX_OPCODE_B:
+        case REX_OPCODE_BWP:
+            if (imm <= pc || (!i_whole && 
+                (o_sizes ? v : io_ac->depth[v]) != 0)
+            ){
+                cut = 1;
+                break;
+            }
+            /* The other branch is taken once this path is done */
+            i_stack[sp * 2] = REX_OP_FROM_INST(i_prog[pc]) == REX_OPCODE_B ? 
+                imm : pc + 1;
+            i_stack[sp * 2 + 1] = v;
+            sp++;
+            pc = REX_OP_FROM_INST(i_prog[pc]) == REX_OPCODE_B ? pc + 1 : imm;
+            continue;
+        case REX_OPCODE_M:
+            break;
+        default:
+            cut = 1;
+            break;
+        }
+
+        /* A match could start anywhere */
+        if ((o_sizes ? v : io_ac->depth[v]) == 0) 
+            return REX_UNSUPPORTED_PROGRAM;
+        if (cut && i_whole) return REX_UNSUPPORTED_PROGRAM;
+        if (o_sizes)
+        {
+            o_sizes[0] += v;
+            o_sizes[1]++;
+        }
+        else if (io_ac->output[v] == REX_AHO_CORASICK_NONE)
+        {
+            io_ac->output[v] = arm;
+        }
+        arm++;
+
+        if (sp == 0) return REX_SUCESS;
+        sp--;
+        pc = i_stack[sp * 2];
+        v = i_stack[sp * 2 + 1];
+    }
+}
+
+/* REX TEDDY */
+
+/*
+ * With a few arms the table walk is slower than comparing the leading bytes
+ * of every arm at 16 or 32 positions at once. Every arm is put in one of
+ * eight buckets and each of its first teddy_sz bytes sets the bit of its
+ * bucket in the mask of its low nibble and in the mask of its high nibble.
+ * A position is a candidate if a bucket bit is left after the masks of the
+ * bytes there are and-ed, and the trie confirms if an arm starts there.
+ *
+ * The instruction set is checked with cpuid when the automaton is built.
+ */
+
+/*
+ * Sets the nibble masks from the trie before the failure transitions are
+ * filled in, each path of teddy_sz bytes from the root leads to the arms
+ * sharing those bytes
+ *
+ * Returns the scanner to use
+ */
+static inline int
+rex_teddy_compile(
+    rex_aho_corasick_t * const io_ac
+){
+    uint8_t class_byte[256];
+    uint32_t path[REX_TEDDY_BYTES + 1];
+    size_t cls[REX_TEDDY_BYTES];
+    size_t i, d, k, bucket;
+    uint32_t t;
+    uint8_t b;
+    int level;
+
+    level = rex_simd_level();
+    if (level == REX_SIMD_NONE) return REX_SIMD_NONE;
+
+    io_ac->teddy_sz = REX_TEDDY_BYTES;
+    for (i = 0; i < io_ac->state_count; i++)
+        if (io_ac->output[i] != REX_AHO_CORASICK_NONE &&
+            io_ac->depth[i] < io_ac->teddy_sz
+        ) io_ac->teddy_sz = io_ac->depth[i];
+    for (i = 0; i < 256; i++) class_byte[io_ac->byte_class[i]] = i;
+
+    bucket = 0;
+    d = 0;
+    cls[0] = 1;
+    path[0] = REX_AHO_CORASICK_ROOT;
+    for (;;)
+    {
+        if (cls[d] == io_ac->class_count)
+        {
+            if (d == 0) break;
+            cls[--d]++;
+            continue;
+        }
+        t = io_ac->next[path[d] * io_ac->class_count + cls[d]];
+        if (t == REX_AHO_CORASICK_NONE)
+        {
+            cls[d]++;
+            continue;
+        }
+        path[d + 1] = t;
+        if (d + 1 < io_ac->teddy_sz)
+        {
+            cls[++d] = 1;
+            continue;
+        }
+        for (k = 0; k < io_ac->teddy_sz; k++)
+        {
+            b = class_byte[cls[k]];
+            io_ac->teddy_lo[k][b & 0x0F] |= 1 << bucket;
+            io_ac->teddy_hi[k][b >> 4] |= 1 << bucket;
+        }
+        bucket = (bucket + 1) % 8;
+        cls[d]++;
+    }
+    return level;
+}
+
+/*
+ * Builds the automaton of a program made of an alternation of literals
+ * or starting with one
+ *
+ * Returns REX_UNSUPPORTED_PROGRAM if the program does not start with
+ * a literal on every path
+ *
+ * Memory Layout
+ *
+ * uint32_t[prog_sz * 2] : walk stack
+ * uint32_t[states * class_count] : next
+ * uint32_t[states] : output
+ * uint32_t[states] : dict
+ * uint32_t[states] : depth
+ * uint32_t[states] : failure links, only used while building
+ * uint32_t[states] : breadth first queue, only used while building
+ */
+static inline int
+rex_aho_corasick_compile(
+    rex_aho_corasick_t * const o_ac,
+    void * const i_memory,
+    const size_t i_memory_sz,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz
+){
+    uint32_t * const stack = i_memory;
+    uint32_t * fail, * queue;
+    size_t sizes[2], states, i, c, head, tail;
+    uint32_t s, t, f;
+    int r;
+
+    if (!o_ac || !i_memory || !i_prog) return REX_BAD_PARAM;
+    if (sizeof(uint32_t) * i_prog_sz * 2 > i_memory_sz) 
+        return REX_OUT_OF_MEMORY;
+
+    REX_MEMSET(o_ac, 0, sizeof(rex_aho_corasick_t));
+    o_ac->whole = 1;
+    r = rex_aho_corasick_walk(o_ac, stack, i_prog, i_prog_sz, 1, sizes);
+    if (r == REX_UNSUPPORTED_PROGRAM)
+    {
+        REX_MEMSET(o_ac->byte_class, 0, sizeof(o_ac->byte_class));
+        o_ac->whole = 0;
+        r = rex_aho_corasick_walk(o_ac, stack, i_prog, i_prog_sz, 0, sizes);
+    }
+    if (r) return r;
+
+    /* Class 0 holds every byte not in a literal */
+    for (i = 0, c = 1; i < 256; i++)
+        o_ac->byte_class[i] = o_ac->byte_class[i] ? c++ : 0;
+    o_ac->class_count = c;
+
+    states = sizes[0] + 1;
+    if (
+        (i_memory_sz - sizeof(uint32_t) * i_prog_sz * 2) / sizeof(uint32_t) / 
+        (o_ac->class_count + 5) < states
+    ) return REX_OUT_OF_MEMORY;
+    o_ac->next = stack + i_prog_sz * 2;
+    o_ac->output = o_ac->next + states * o_ac->class_count;
+    o_ac->dict = o_ac->output + states;
+    o_ac->depth = o_ac->dict + states;
+    fail = o_ac->depth + states;
+    queue = fail + states;
+    REX_MEMSET(
+        o_ac->next,
+        0xFF,
+        sizeof(uint32_t) * (states * o_ac->class_count + states)
+    );
+    o_ac->depth[REX_AHO_CORASICK_ROOT] = 0;
+    o_ac->state_count = 1;
+    r = rex_aho_corasick_walk(
+        o_ac,
+        stack,
+        i_prog,
+        i_prog_sz,
+        o_ac->whole,
+        NULL
+    );
+    if (r) return r;
+    if (sizes[1] <= REX_TEDDY_ARMS) o_ac->teddy = rex_teddy_compile(o_ac);
+
+    /* Breadth first so failure links point at finished states */
+    fail[REX_AHO_CORASICK_ROOT] = REX_AHO_CORASICK_ROOT;
+    for (head = 0, tail = 0, s = REX_AHO_CORASICK_ROOT;; s = queue[head++])
+    {
+        for (c = 0; c < o_ac->class_count; c++)
+        {
+            t = o_ac->next[s * o_ac->class_count + c];
+            f = o_ac->next[fail[s] * o_ac->class_count + c];
+            if (t == REX_AHO_CORASICK_NONE)
+            {
+                o_ac->next[s * o_ac->class_count + c] = 
+                    s == REX_AHO_CORASICK_ROOT ? REX_AHO_CORASICK_ROOT : f;
+                continue;
+            }
+            fail[t] = s == REX_AHO_CORASICK_ROOT ? REX_AHO_CORASICK_ROOT : f;
+            queue[tail++] = t;
+        }
+        if (head == tail) break;
+    }
+    for (i = 0; i < tail; i++)
+    {
+        t = queue[i];
+        f = fail[t];
+        /* Parents come first in the queue */
+        o_ac->dict[t] = o_ac->output[f] != REX_AHO_CORASICK_NONE ? f : 
+            f == REX_AHO_CORASICK_ROOT ? REX_AHO_CORASICK_NONE : o_ac->dict[f];
+    }
+    o_ac->dict[REX_AHO_CORASICK_ROOT] = REX_AHO_CORASICK_NONE;
+    for (i = 0; i < o_ac->state_count; i++)
+        if (o_ac->depth[i] > o_ac->max_depth) o_ac->max_depth = o_ac->depth[i];
+    return REX_SUCESS;
+}
+
+
+/*
+ * Returns the end of the highest priority arm starting at i_pos or SIZE_MAX
+ * The trie transitions are the ones going a byte deeper
+ */
+static inline size_t
+rex_aho_corasick_arm_at(
+    const rex_aho_corasick_t * const i_ac,
+    const uint8_t * const i_str,
+    const size_t i_string_sz,
+    const size_t i_pos
+){
+    uint32_t s, t, arm;
+    size_t i, end;
+
+    arm = REX_AHO_CORASICK_NONE;
+    end = SIZE_MAX;
+    s = REX_AHO_CORASICK_ROOT;
+    for (i = i_pos; i < i_string_sz && i_str[i]; i++)
+    {
+        t = i_ac->next[s * i_ac->class_count + i_ac->byte_class[i_str[i]]];
+        if (i_ac->depth[t] != i_ac->depth[s] + 1) break;
+        s = t;
+        if (i_ac->output[s] < arm)
+        {
+            arm = i_ac->output[s];
+            end = i + 1;
+        }
+    }
+    return end;
+}
+
+/* Returns non zero if the bytes at i_pos are in one bucket */
+static inline int
+rex_teddy_candidate(
+    const rex_aho_corasick_t * const i_ac,
+    const uint8_t * const i_str,
+    const size_t i_pos
+){
+    uint8_t m, b;
+    size_t k;
+
+    m = 0xFF;
+    for (k = 0; k < i_ac->teddy_sz; k++)
+    {
+        b = i_str[i_pos + k];
+        m &= i_ac->teddy_lo[k][b & 0x0F] & i_ac->teddy_hi[k][b >> 4];
+    }
+    return m != 0;
+}
+
+#ifdef REX_SIMD_X86
+/*
+ * Scans the candidates in blocks of 16 while the block and the bytes after
+ * it are before i_end and stops at the first arm
+ *
+ * Returns the first position not scanned
+ * o_start and o_end are SIZE_MAX if no arm was found
+ */
+__attribute__((target("ssse3")))
+static size_t
+rex_teddy_scan_ssse3(
+    const rex_aho_corasick_t * const i_ac,
+    const uint8_t * const i_str,
+    const size_t i_string_sz,
+    size_t i_pos,
+    const size_t i_end,
+    size_t * const o_start,
+    size_t * const o_end
+){
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i lo[REX_TEDDY_BYTES], hi[REX_TEDDY_BYTES], c, r;
+    unsigned int mask;
+    size_t k;
+
+    *o_start = *o_end = SIZE_MAX;
+    for (k = 0; k < i_ac->teddy_sz; k++)
+    {
+        lo[k] = _mm_loadu_si128((const __m128i *) i_ac->teddy_lo[k]);
+        hi[k] = _mm_loadu_si128((const __m128i *) i_ac->teddy_hi[k]);
+    }
+    for (; i_pos + 16 + i_ac->teddy_sz - 1 <= i_end; i_pos += 16)
+    {
+        r = _mm_set1_epi8(-1);
+        for (k = 0; k < i_ac->teddy_sz; k++)
+        {
+            c = _mm_loadu_si128((const __m128i *) (i_str + i_pos + k));
+            r = _mm_and_si128(r, _mm_and_si128(
+                _mm_shuffle_epi8(lo[k], _mm_and_si128(c, nibble)),
+                _mm_shuffle_epi8(hi[k],
+                    _mm_and_si128(_mm_srli_epi16(c, 4), nibble))
+            ));
+        }
+        mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(r, _mm_setzero_si128()));
+        for (mask &= 0xFFFF; mask; mask &= mask - 1)
+        {
+            *o_end = rex_aho_corasick_arm_at(
+                i_ac,
+                i_str,
+                i_string_sz,
+                i_pos + __builtin_ctz(mask)
+            );
+            if (*o_end == SIZE_MAX) continue;
+            *o_start = i_pos + __builtin_ctz(mask);
+            return i_pos;
+        }
+    }
+    return i_pos;
+}
+
+/* The same as rex_teddy_scan_ssse3 in blocks of 32 */
+__attribute__((target("avx2")))
+static size_t
+rex_teddy_scan_avx2(
+    const rex_aho_corasick_t * const i_ac,
+    const uint8_t * const i_str,
+    const size_t i_string_sz,
+    size_t i_pos,
+    const size_t i_end,
+    size_t * const o_start,
+    size_t * const o_end
+){
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i lo[REX_TEDDY_BYTES], hi[REX_TEDDY_BYTES], c, r;
+    unsigned int mask;
+    size_t k;
+
+    *o_start = *o_end = SIZE_MAX;
+    /* The shuffle looks up each 128 bit lane on its own */
+    for (k = 0; k < i_ac->teddy_sz; k++)
+    {
+        lo[k] = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *) i_ac->teddy_lo[k]));
+        hi[k] = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *) i_ac->teddy_hi[k]));
+    }
+    for (; i_pos + 32 + i_ac->teddy_sz - 1 <= i_end; i_pos += 32)
+    {
+        r = _mm256_set1_epi8(-1);
+        for (k = 0; k < i_ac->teddy_sz; k++)
+        {
+            c = _mm256_loadu_si256((const __m256i *) (i_str + i_pos + k));
+            r = _mm256_and_si256(r, _mm256_and_si256(
+                _mm256_shuffle_epi8(lo[k], _mm256_and_si256(c, nibble)),
+                _mm256_shuffle_epi8(hi[k],
+                    _mm256_and_si256(_mm256_srli_epi16(c, 4), nibble))
+            ));
+        }
+        mask = ~(unsigned int) _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(r, _mm256_setzero_si256()));
+        for (; mask; mask &= mask - 1)
+        {
+            *o_end = rex_aho_corasick_arm_at(
+                i_ac,
+                i_str,
+                i_string_sz,
+                i_pos + __builtin_ctz(mask)
+            );
+            if (*o_end == SIZE_MAX) continue;
+            *o_start = i_pos + __builtin_ctz(mask);
+            return i_pos;
+        }
+    }
+    return i_pos;
+}
+#endif
+
+/*
+ * rex_aho_corasick_find with the packed scanner
+ * The blocks are scanned in windows cut at the terminator and the positions
+ * left at the end of a window are checked one at a time
+ */
+static inline void
+rex_teddy_find(
+    const rex_aho_corasick_t * const i_ac,
+    const char * const i_string,
+    const size_t i_string_sz,
+    size_t i_pos,
+    size_t * const o_start,
+    size_t * const o_end
+){
+    const uint8_t * const str = (const uint8_t *) i_string;
+    size_t n, end, i;
+
+    *o_start = *o_end = SIZE_MAX;
+    while (i_pos < i_string_sz)
+    {
+        /* Every byte before the terminator can be loaded */
+        n = rex_string_window(i_string, i_string_sz, i_pos, 
+            REX_LITERAL_WINDOW);
+        end = i_pos + n;
+        i = i_pos;
+#ifdef REX_SIMD_X86
+        if (i_ac->teddy == REX_SIMD_AVX2)
+            i = rex_teddy_scan_avx2(
+                i_ac, str, i_string_sz, i, end, o_start, o_end);
+        else if (i_ac->teddy == REX_SIMD_SSSE3)
+            i = rex_teddy_scan_ssse3(
+                i_ac, str, i_string_sz, i, end, o_start, o_end);
+        if (*o_start != SIZE_MAX) return;
+#endif
+        for (; i + i_ac->teddy_sz <= end; i++)
+        {
+            if (!rex_teddy_candidate(i_ac, str, i)) continue;
+            *o_end = rex_aho_corasick_arm_at(i_ac, str, i_string_sz, i);
+            if (*o_end == SIZE_MAX) continue;
+            *o_start = i;
+            return;
+        }
+        if (n < REX_LITERAL_WINDOW || end == i_string_sz) return;
+        /* The last positions need the bytes of the next window */
+        i_pos = end - i_ac->teddy_sz + 1;
+    }
+}
+
+/*
+ * Finds the leftmost arm at or after i_pos and of the arms starting there
+ * the one with the highest priority, which is the match the VM reports
+ * o_start and o_end are SIZE_MAX if there is none
+ */
+static inline void
+rex_aho_corasick_find(
+    const rex_aho_corasick_t * const i_ac,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_pos,
+    size_t * const o_start,
+    size_t * const o_end
+){
+    const uint8_t * const str = (const uint8_t *) i_string;
+    uint32_t s, t, arm;
+    size_t i, start;
+
+    if (i_ac->teddy != REX_SIMD_NONE)
+    {
+        rex_teddy_find(i_ac, i_string, i_string_sz, i_pos, o_start, o_end);
+        return;
+    }
+    *o_start = *o_end = SIZE_MAX;
+    arm = REX_AHO_CORASICK_NONE;
+    s = REX_AHO_CORASICK_ROOT;
+    for (i = i_pos; i < i_string_sz && str[i]; i++)
+    {
+        /* Arms starting at *o_start or before have all ended */
+        if (*o_start != SIZE_MAX && i - *o_start >= i_ac->max_depth) break;
+        s = i_ac->next[s * i_ac->class_count + i_ac->byte_class[str[i]]];
+        for (
+            t = i_ac->output[s] != REX_AHO_CORASICK_NONE ? s : i_ac->dict[s];
+            t != REX_AHO_CORASICK_NONE;
+            t = i_ac->dict[t]
+        ){
+            start = i + 1 - i_ac->depth[t];
+            if (start > *o_start || 
+                (start == *o_start && i_ac->output[t] > arm)
+            ) continue;
+            *o_start = start;
+            *o_end = i + 1;
+            arm = i_ac->output[t];
+        }
+    }
+}
+
+
+/* REX SETS */
+
+/*
+ * The constant pool of a program follows its prog_sz instructions and holds
+ * the sets HNSA tests. The offset of a set is counted from the start of the
+ * pool. ASCII is a bit test and other codepoints are binary searched in the
+ * ranges of the set, which are sorted and do not touch, so large Unicode
+ * classes cost a few comparisons per codepoint.
+ *
+ * Set Memory Layout
+ *
+ * uint32_t : range count N
+ * uint32_t[4] : bitmap of the ASCII codepoints, bit cp % 32 of word cp / 32
+ * uint32_t[N * 2] : first and last codepoint of every range past ASCII
+ */
+#define REX_SET_BITMAP (1)
+#define REX_SET_RANGES (5)
+/* Words of a set with i_range_count ranges */
+#define REX_SET_SZ(range_count) (REX_SET_RANGES + (range_count) * 2)
+
+static inline int
+rex_set_contains(
+    const uint32_t * const i_set,
+    const uint32_t i_cp
+){
+    const uint32_t * const ranges = i_set + REX_SET_RANGES;
+    uint32_t lo, hi, mid;
+    if (i_cp < 0x80) 
+        return (i_set[REX_SET_BITMAP + i_cp / 32] >> (i_cp % 32)) & 1;
+    /* First range not ending before i_cp */
+    for (lo = 0, hi = i_set[0]; lo < hi;)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (ranges[mid * 2 + 1] < i_cp) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < i_set[0] && ranges[lo * 2] <= i_cp;
+}
+
+
+/* REX EPSILON CLOSURES */
+
+/*
+ * A node is pc 0 or the pc following an advancing instruction, the pcs the
+ * VM adds threads at. The closure of a node is the list of threads adding it
+ * leaves, the halt chains and M reached through J, B, BWP, SS and the
+ * assertions in priority order, each with the SS run on its way there.
+ * rex_closures_compile walks every node once per outcome of the assertions
+ * the program tests, so the VM adds a node by reading its closure instead of
+ * chasing jumps.
+ *
+ * The VM only checks the pcs of the threads against the list. A walk cut at
+ * a pc already visited while building the list would only have reached
+ * threads already in it, so the threads added are the same.
+ *
+ * The closures of pc 0 are the start thread lists of a run, one for every
+ * context of anchoring and word boundary, which the VM copies in as it
+ * starts.
+ */
+typedef struct rex_closures_s rex_closures_t;
+
+struct rex_closures_s
+{
+    const rex_instruction_t * prog;
+    size_t prog_sz;
+    /* Offset of the closure of every pc and context in closures */
+    uint32_t * index;
+    uint32_t * closures;
+    size_t closures_sz;
+    /* Facts the program tests, a context is the facts that hold */
+    uint32_t facts;
+};
+
+/* Closure Layout
+ *
+ * uint32_t : thread count
+ * per thread
+ *      uint32_t : pc
+ *      uint32_t : SS count N
+ *      uint32_t[N] : immediates of the SS run on the way
+ */
+#define REX_CLOSURES_NONE           (0xFFFFFFFF)
+#define REX_CLOSURES_FACT_START     (1)
+#define REX_CLOSURES_FACT_END       (2)
+#define REX_CLOSURES_FACT_BOUNDARY  (4)
+#define REX_CLOSURES_CONTEXTS       (8)
+
+/* Returns the closure of i_pc where i_facts hold or NULL if it is no node */
+static inline const uint32_t *
+rex_closures_find(
+    const rex_closures_t * const i_closures,
+    const uint32_t i_pc,
+    const uint32_t i_facts
+){
+    const size_t stride = i_closures->facts ? REX_CLOSURES_CONTEXTS : 1;
+    uint32_t offset;
+    if (i_pc >= i_closures->prog_sz) return NULL;
+    offset = i_closures->index[i_pc * stride + (i_facts & i_closures->facts)];
+    return offset == REX_CLOSURES_NONE ? NULL : i_closures->closures + offset;
+}
+
+/* 
+ * Returns REX_UNSUPPORTED_PROGRAM if a walk leaves the program
+ * and REX_OUT_OF_MEMORY if the closures do not fit
+ *
+ * Memory Layout
+ *
+ * uint32_t[prog_sz * contexts] : closure offset of every pc and context,
+ *                                8 contexts if the program has assertions
+ * uint32_t[] : closures
+ * uint32_t[prog_sz] : last walk to visit a pc
+ * uint32_t[prog_sz * 2] : walk stack, pc and SS count
+ * uint32_t[prog_sz] : SS run on the way
+ */
+int
+rex_closures_compile(
+    rex_closures_t * const o_closures,
+    void * const i_memory,
+    const size_t i_memory_sz,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz
+){
+    uint32_t * const mem = i_memory;
+    const size_t words = i_memory_sz / sizeof(uint32_t);
+    uint32_t * index, * closures, * visited, * stack, * trail;
+    size_t pc, ctx, stride, limit, w, count, sp, tl, i;
+    uint32_t facts = 0, stamp = 0, at, op, imm;
+    int asserted = 0;
+
+    if (!o_closures || !i_memory || !i_prog) return REX_BAD_PARAM;
+    for (pc = 0; pc < i_prog_sz; pc++)
+    {
+        switch (REX_OP_FROM_INST(i_prog[pc]))
+        {
+        case REX_OPCODE_AS:
+            facts |= REX_CLOSURES_FACT_START;
+            break;
+        case REX_OPCODE_AE:
+            facts |= REX_CLOSURES_FACT_END;
+            break;
+        case REX_OPCODE_AWB:
+        case REX_OPCODE_ANWB:
+            facts |= REX_CLOSURES_FACT_BOUNDARY;
+            break;
+        }
+    }
+    stride = facts ? REX_CLOSURES_CONTEXTS : 1;
+    if (i_prog_sz * (stride + 4) > words) return REX_OUT_OF_MEMORY;
+    index = mem;
+    closures = index + i_prog_sz * stride;
+    limit = REX_MIN(words - i_prog_sz * (stride + 4), REX_CLOSURES_NONE - 1);
+    visited = mem + words - i_prog_sz * 4;
+    stack = visited + i_prog_sz;
+    trail = stack + i_prog_sz * 2;
+    REX_MEMSET(visited, 0, sizeof(uint32_t) * i_prog_sz);
+
+    for (pc = 0, w = 0; pc < i_prog_sz; pc++)
+    {
+        if (pc != 0 && (REX_INST_IS_JUMP_TYPE(i_prog[pc - 1]) ||
+            !(REX_OP_FROM_INST(i_prog[pc - 1]) & REX_MICROCODE_ADVANCE))
+        ){
+            for (ctx = 0; ctx < stride; ctx++) 
+                index[pc * stride + ctx] = REX_CLOSURES_NONE;
+            continue;
+        }
+        /* Set by the walk of the first context */
+        asserted = 0;
+        for (ctx = 0; ctx < stride; ctx++)
+        {
+            if (ctx != 0 && (!asserted || (ctx & ~facts)))
+            {
+                /* The closure does not depend on these facts */
+                index[pc * stride + ctx] = 
+                    index[pc * stride + (asserted ? ctx & facts : 0)];
+                continue;
+            }
+            if (w + 1 > limit) return REX_OUT_OF_MEMORY;
+            index[pc * stride + ctx] = w;
+            count = w++;
+            closures[count] = 0;
+            stamp++;
+            at = pc;
+            sp = 0;
+            tl = 0;
+            /* Same walk as rex_vm_thread_add */
+            for (;;)
+            {
+                if (at >= i_prog_sz) return REX_UNSUPPORTED_PROGRAM;
+                if (visited[at] == stamp) goto walk_pop;
+                visited[at] = stamp;
+                op = REX_OP_FROM_INST(i_prog[at]);
+                imm = REX_IMM_FROM_INST(i_prog[at]);
+                switch (op)
+                {
+                case REX_OPCODE_J:
+                    at = imm;
+                    continue;
+                case REX_OPCODE_B:
+                    stack[sp * 2] = imm;
+                    stack[sp++ * 2 + 1] = tl;
+                    at++;
+                    continue;
+                case REX_OPCODE_BWP:
+                    stack[sp * 2] = at + 1;
+                    stack[sp++ * 2 + 1] = tl;
+                    at = imm;
+                    continue;
+                case REX_OPCODE_SS:
+                    trail[tl++] = imm;
+                    at++;
+                    continue;
+                case REX_OPCODE_AS:
+                case REX_OPCODE_AE:
+                case REX_OPCODE_AWB:
+                case REX_OPCODE_ANWB:
+                    asserted = 1;
+                    if (
+                        (op == REX_OPCODE_AS && 
+                            !(ctx & REX_CLOSURES_FACT_START)) ||
+                        (op == REX_OPCODE_AE && 
+                            !(ctx & REX_CLOSURES_FACT_END)) ||
+                        (op == REX_OPCODE_AWB && 
+                            !(ctx & REX_CLOSURES_FACT_BOUNDARY)) ||
+                        (op == REX_OPCODE_ANWB && 
+                            (ctx & REX_CLOSURES_FACT_BOUNDARY))
+                    ) goto walk_pop;
+                    at++;
+                    continue;
+                default:
+                    /* A thread of the closure */
+                    if (w + 2 + tl > limit) return REX_OUT_OF_MEMORY;
+                    closures[w++] = at;
+                    closures[w++] = tl;
+                    for (i = 0; i < tl; i++) closures[w++] = trail[i];
+                    closures[count]++;
+                    break;
+                }
+            walk_pop:
+                if (sp == 0) break;
+                sp--;
+                at = stack[sp * 2];
+                tl = stack[sp * 2 + 1];
+            }
+        }
+    }
+
+    o_closures->prog = i_prog;
+    o_closures->prog_sz = i_prog_sz;
+    o_closures->index = index;
+    o_closures->closures = closures;
+    o_closures->closures_sz = w;
+    o_closures->facts = facts;
+    return REX_SUCESS;
+}
+
+/* REX VIRTUAL MACHINE */
+typedef struct rex_match_s rex_match_t;
+typedef struct rex_stream_match_s rex_stream_match_t;
+typedef struct rex_vm_s rex_vm_t;
+typedef struct rex_vm_threadlist_s rex_vm_threadlist_t;
+
+/* Thread Memory Layout
+ *
+ * uint32_t : pc
+ * uint32_t : capture slot, if more than the match is extracted
+ * size_t   : match start, if only the match is, copied as it is unaligned
+ *
+ * Capture Slot Memory Layout
+ *
+ * size_t[N*2] : match markers, REX_VM_NO_MARKER until saved
+ *
+ * Positions are absolute, string_offset + index into string, so they
+ * outlive the chunk of a stream they were saved in.
+ * Threads share a slot until one of them saves a marker, which copies the
+ * slot first when it has other references. Branching a thread adds a
+ * reference and advancing one hands its reference on, neither copies markers.
+ */
+
+struct rex_match_s
+{
+    const char * match;
+    size_t match_sz;
+};
+
+/* A match of a stream, offset is SIZE_MAX for a group that did not match */
+struct rex_stream_match_s
+{
+    size_t offset;
+    size_t match_sz;
+};
+
+#define REX_VM_NO_MARKER (SIZE_MAX)
+
+/* Thread lists double as a sparse set of the pcs visited while building them
+ * sparse[pc] indexes dense, dense[i] holds a pc
+ * A pc is a member when sparse[pc] < visited_count && dense[sparse[pc]] == pc
+ * Both arrays hold prog_sz entries and clearing the set is O(1)
+ */
+struct rex_vm_threadlist_s
+{
+    void * buffer;
+    size_t thread_count;
+    size_t marker_count;
+    uint32_t * sparse;
+    uint32_t * dense;
+    size_t visited_count;
+};
+
+#define REX_VM_THREAD_SLOT(thread) (((uint32_t*) thread)[1])
+
+/* Runs extracting groups keep their markers in capture slots */
+#define REX_VM_USES_SLOTS(marker_count) ((marker_count) > 2)
+
+#define REX_VM_THREAD_SZ(marker_count) (sizeof(uint32_t) + ( \
+    REX_VM_USES_SLOTS(marker_count) ? sizeof(uint32_t) : \
+    (marker_count) != 0 ? sizeof(size_t) : 0))
+
+/* Slot of a thread holding no reference */
+#define REX_VM_SLOT_NONE (~(uint32_t)0)
+
+#define REX_VM_SLOT_COUNT(prog_sz) ((prog_sz) * 2 + 1)
+
+#ifdef REX_VM_THREADED
+/* An instruction decoded for threaded dispatch */
+typedef struct rex_vm_op_s
+{
+    const void * handler;
+    uint32_t imm;
+} rex_vm_op_t;
+
+/* Room is left to align the rex_vm_op_t[prog_sz + 1] in any memory */
+#define REX_VM_OPS_SZ(prog_sz) (sizeof(void *) - 1 + \
+    sizeof(rex_vm_op_t) * ((prog_sz) + 1))
+#else
+#define REX_VM_OPS_SZ(prog_sz) (0)
+#endif
+
+/* 
+ * A program decoded once by rex_vm_ops_compile for the runs of
+ * rex_vm_exec_ops and rex_vm_search_ops, which then skip decoding it.
+ * Other runs decode the program into the VM memory as they start.
+ * Without REX_THREADED_DISPATCH it only names the program.
+ */
+typedef struct rex_vm_ops_s rex_vm_ops_t;
+
+struct rex_vm_ops_s
+{
+    const rex_instruction_t * prog;
+    size_t prog_sz;
+#ifdef REX_VM_THREADED
+    const rex_vm_op_t * op;
+#endif
+};
+
+/* Returns the minimum rex_vm_t memory_sz needed to execute a program 
+ * Memory Layout
+ *
+ * rex_vm_op_t[prog_sz + 1] : decoded program, aligned, with 
+ *                            REX_THREADED_DISPATCH
+ * uint32_t[prog_sz] : clist sparse
+ * uint32_t[prog_sz] : clist dense
+ * uint32_t[prog_sz] : nlist sparse
+ * uint32_t[prog_sz] : nlist dense
+ * thread[prog_sz] : clist
+ * thread[prog_sz] : nlist
+ * thread[prog_sz] : pending thread stack
+ * capture slot[REX_VM_SLOT_COUNT] : if groups are extracted, see below
+ * uint32_t[REX_VM_SLOT_COUNT] : reference count of every slot or next free slot
+ *
+ * A slot is referenced by list threads, which sit on halt chains and M,
+ * by stacked threads, one per B or BWP, and by the thread being expanded.
+ * Both lists and the stack together hold at most 2 * prog_sz threads.
+ */
+static inline size_t
+rex_vm_memory_sz(
+    const size_t i_prog_sz,
+    const size_t i_matches_sz
+){
+    const size_t marker_count = i_matches_sz * 2;
+    return REX_VM_OPS_SZ(i_prog_sz) + i_prog_sz * 
+        (sizeof(uint32_t) * 4 + REX_VM_THREAD_SZ(marker_count) * 3) +
+        (REX_VM_USES_SLOTS(marker_count) ?
+            REX_VM_SLOT_COUNT(i_prog_sz) *
+            (sizeof(size_t) * marker_count + sizeof(uint32_t)) : 0);
+}
+
+#ifdef REX_VM_THREADED
+/* Returns the first pointer-aligned address of i_memory for the ops */
+static inline rex_vm_op_t *
+rex_vm_ops_align(
+    void * const i_memory
+){
+    const size_t align = sizeof(void *);
+    return (rex_vm_op_t *)((uint8_t *) i_memory + 
+        (align - (uintptr_t) i_memory % align) % align);
+}
+#endif
+
+static inline int
+rex_vm_threadlist_contains(
+    const rex_vm_threadlist_t * const i_threadlist,
+    const uint32_t i_pc
+){
+    const uint32_t i = i_threadlist->sparse[i_pc];
+    return i < i_threadlist->visited_count && i_threadlist->dense[i] == i_pc;
+}
+
+/* Returns 0 if i_pc was already visited */
+static inline int
+rex_vm_threadlist_visit(
+    rex_vm_threadlist_t * const io_threadlist,
+    const uint32_t i_pc
+){
+    if (rex_vm_threadlist_contains(io_threadlist, i_pc)) return 0;
+    io_threadlist->sparse[i_pc] = io_threadlist->visited_count;
+    io_threadlist->dense[io_threadlist->visited_count++] = i_pc;
+    return 1;
+}
+
+static inline void
+rex_vm_threadlist_clear(
+    rex_vm_threadlist_t * const io_threadlist
+){
+    io_threadlist->thread_count = 0;
+    io_threadlist->visited_count = 0;
+}
+
+void *
+rex_vm_thread_by_index(
+    const rex_vm_threadlist_t * const i_threadlist,
+    const size_t i_thread_index
+){
+    uint8_t * const byte_buffer = i_threadlist->buffer;
+    return byte_buffer + 
+        i_thread_index * REX_VM_THREAD_SZ(i_threadlist->marker_count);
+}
+
+struct rex_vm_s
+{
+    void * memory;
+    size_t memory_sz;
+    const char * string;
+    size_t string_sz;
+    size_t string_start;
+    /* Last position threads are run at */
+    size_t string_stop;
+    const rex_instruction_t * prog;
+    size_t prog_sz;
+    rex_match_t * matches;
+    /* Set instead of matches when running a stream */
+    rex_stream_match_t * stream_matches;
+    size_t matches_sz;
+    /* Absolute position of string[0], moved by a stream as chunks come in */
+    size_t string_offset;
+    rex_vm_threadlist_t clist, nlist;
+    void * stack;
+    size_t thread_sz;
+    /* Capture slots and their reference counts, see rex_vm_memory_sz */
+    size_t * slots;
+    uint32_t * slot_refs;
+    /* Released slots are chained through slot_refs, then come the unused */
+    uint32_t slot_free, slot_next, slot_max;
+    size_t cpi, l, ti;
+    uint32_t  pc;
+    uint32_t cp, rcp1;
+    uint8_t prev_word;
+    void * cthread;
+    int match;
+    int halted;
+    int unanchored;
+    /* Unanchored threads are only started where one can be reached, NULLABLE */
+    const rex_literal_t * literal;
+    const rex_aho_corasick_t * literal_set;
+    size_t literal_next;
+    /* The bytes before ascii_end are ASCII and decoded without the parser */
+    size_t ascii_end;
+    /* The bytes ahead up to ascii_checked are known to hold no terminator */
+    size_t ascii_checked;
+    int simd;
+    /* The program is a byte program, see REX BYTE PROGRAMS */
+    int bytes;
+    /* Closures of the program, NULLABLE, see REX EPSILON CLOSURES */
+    const rex_closures_t * closures;
+#ifdef REX_VM_THREADED
+    /* The decoded program, or NULL until the first thread run decodes
+     * it into decode */
+    const rex_vm_op_t * ops;
+    rex_vm_op_t * decode;
+#endif
+};
+
+/* Flags of a VM run */
+#define REX_VM_UNANCHORED   (1)
+#define REX_VM_BYTES        (2)
+
+static inline size_t *
+rex_vm_slot_markers(
+    const rex_vm_t * const i_vm,
+    const uint32_t i_slot
+){
+    return i_vm->slots + (size_t) i_slot * i_vm->clist.marker_count;
+}
+
+/* Returns a slot with one reference or REX_VM_SLOT_NONE if none is free */
+static inline uint32_t
+rex_vm_slot_alloc(
+    rex_vm_t * const io_vm
+){
+    uint32_t slot = io_vm->slot_free;
+    if (slot != REX_VM_SLOT_NONE) 
+        io_vm->slot_free = io_vm->slot_refs[slot];
+    else if (io_vm->slot_next < io_vm->slot_max)
+        slot = io_vm->slot_next++;
+    else 
+        return REX_VM_SLOT_NONE;
+    io_vm->slot_refs[slot] = 1;
+    return slot;
+}
+
+static inline void
+rex_vm_slot_release(
+    rex_vm_t * const io_vm,
+    const uint32_t i_slot
+){
+    if (i_slot == REX_VM_SLOT_NONE || --io_vm->slot_refs[i_slot]) return;
+    io_vm->slot_refs[i_slot] = io_vm->slot_free;
+    io_vm->slot_free = i_slot;
+}
+
+/* Saves match i_index between the absolute positions i_start and i_end */
+static inline void
+rex_vm_match_save(
+    rex_vm_t * const io_vm,
+    const size_t i_index,
+    const size_t i_start,
+    const size_t i_end
+){
+    const int none = i_start == REX_VM_NO_MARKER || i_end == REX_VM_NO_MARKER;
+    if (io_vm->stream_matches)
+        io_vm->stream_matches[i_index] = none ? 
+            (rex_stream_match_t){SIZE_MAX, 0} :
+            (rex_stream_match_t){i_start, i_end - i_start};
+    else
+        io_vm->matches[i_index] = none ?
+            (rex_match_t){NULL, 0} :
+            (rex_match_t){
+                io_vm->string + (i_start - io_vm->string_offset), 
+                i_end - i_start
+            };
+}
+
+/* Drops the references of every thread in io_threadlist and clears it */
+static inline void
+rex_vm_threadlist_release(
+    rex_vm_t * const io_vm,
+    rex_vm_threadlist_t * const io_threadlist
+){
+    size_t i;
+    if (REX_VM_USES_SLOTS(io_threadlist->marker_count))
+        for (i = 0; i < io_threadlist->thread_count; i++)
+            rex_vm_slot_release(
+                io_vm,
+                REX_VM_THREAD_SLOT(rex_vm_thread_by_index(io_threadlist, i))
+            );
+    rex_vm_threadlist_clear(io_threadlist);
+}
+
+/* Returns the REX_CLOSURES_FACT that hold at i_pos */
+static inline uint32_t
+rex_vm_facts(
+    const rex_vm_t * const i_vm,
+    const size_t i_pos,
+    const uint8_t i_prev_word
+){
+    const uint8_t at_end = 
+        i_pos == i_vm->string_sz || i_vm->string[i_pos] == 0;
+    const uint8_t next_word = at_end ? 0 : REX_ISWORD(i_vm->string[i_pos]);
+    return (i_pos == 0 ? REX_CLOSURES_FACT_START : 0) |
+        (at_end ? REX_CLOSURES_FACT_END : 0) |
+        (i_prev_word != next_word ? REX_CLOSURES_FACT_BOUNDARY : 0);
+}
+
+/* 
+ * Seeds the empty io_threadlist with the threads of i_closure, the closure
+ * of pc 0 from rex_closures_find. No pc repeats in a closure so the threads
+ * are copied in without checking the list.
+ */
+static int
+rex_vm_closure_start(
+    rex_vm_t * const io_vm,
+    rex_vm_threadlist_t * const io_threadlist,
+    const uint32_t * i_closure,
+    const size_t i_str_pos
+){
+    const size_t marker_count = io_threadlist->marker_count;
+    const int slots = REX_VM_USES_SLOTS(marker_count);
+    const uint32_t count = *i_closure++;
+    const uint32_t * ss;
+    uint32_t * thread;
+    size_t * markers = NULL, * copy_markers;
+    uint32_t t, n, i, slot = REX_VM_SLOT_NONE, copy;
+
+    if (slots)
+    {
+        slot = rex_vm_slot_alloc(io_vm);
+        if (slot == REX_VM_SLOT_NONE) return REX_OUT_OF_MEMORY;
+        markers = rex_vm_slot_markers(io_vm, slot);
+        REX_MEMSET(markers, 0xFF, sizeof(size_t) * marker_count);
+        markers[0] = i_str_pos;
+    }
+    for (t = 0; t < count; t++, i_closure += 2 + n)
+    {
+        n = i_closure[1];
+        ss = i_closure + 2;
+        thread = rex_vm_thread_by_index(io_threadlist, t);
+        thread[0] = i_closure[0];
+        io_threadlist->sparse[i_closure[0]] = t;
+        io_threadlist->dense[t] = i_closure[0];
+        if (!slots)
+        {
+            /* A fresh thread starts where an SS 0 would move it */
+            if (marker_count) 
+                REX_MEMCPY(thread + 1, &i_str_pos, sizeof(size_t));
+            continue;
+        }
+        for (i = 0; i < n && (ss[i] >= marker_count || ss[i] == 0); i++);
+        if (i == n)
+        {
+            io_vm->slot_refs[slot]++;
+            thread[1] = slot;
+            continue;
+        }
+        copy = rex_vm_slot_alloc(io_vm);
+        if (copy == REX_VM_SLOT_NONE)
+        {
+            io_threadlist->thread_count = t;
+            rex_vm_slot_release(io_vm, slot);
+            return REX_OUT_OF_MEMORY;
+        }
+        copy_markers = rex_vm_slot_markers(io_vm, copy);
+        REX_MEMCPY(copy_markers, markers, sizeof(size_t) * marker_count);
+        for (; i < n; i++) 
+            if (ss[i] < marker_count) copy_markers[ss[i]] = i_str_pos;
+        thread[1] = copy;
+    }
+    io_threadlist->thread_count = count;
+    io_threadlist->visited_count = count;
+    rex_vm_threadlist_visit(io_threadlist, 0);
+    if (slots) rex_vm_slot_release(io_vm, slot);
+    return REX_SUCESS;
+}
+
+/* 
+ * Adds the threads of i_closure to io_threadlist, the closure of the node 
+ * i_pc from rex_closures_find, see rex_vm_thread_add
+ */
+static int
+rex_vm_closure_add(
+    rex_vm_t * const io_vm,
+    rex_vm_threadlist_t * const io_threadlist,
+    const void * const i_from,
+    const uint32_t i_pc,
+    const uint32_t * i_closure,
+    const size_t i_str_pos
+){
+    const size_t marker_count = io_threadlist->marker_count;
+    const int slots = REX_VM_USES_SLOTS(marker_count);
+    const uint32_t * ss;
+    uint32_t * thread;
+    size_t * markers;
+    size_t start = i_str_pos;
+    uint32_t count, n, i, slot = REX_VM_SLOT_NONE, copy;
+
+    if (slots && i_from)
+    {
+        slot = REX_VM_THREAD_SLOT(i_from);
+    }else if (slots){
+        slot = rex_vm_slot_alloc(io_vm);
+        if (slot == REX_VM_SLOT_NONE) return REX_OUT_OF_MEMORY;
+        markers = rex_vm_slot_markers(io_vm, slot);
+        REX_MEMSET(markers, 0xFF, sizeof(size_t) * marker_count);
+        markers[0] = i_str_pos;
+    }else if (marker_count && i_from){
+        REX_MEMCPY(&start, (const uint32_t *) i_from + 1, sizeof(size_t));
+    }
+
+    for (count = *i_closure++; count--; i_closure += 2 + n)
+    {
+        n = i_closure[1];
+        ss = i_closure + 2;
+        if (!rex_vm_threadlist_visit(io_threadlist, i_closure[0])) continue;
+        thread = rex_vm_thread_by_index(
+            io_threadlist, 
+            io_threadlist->thread_count++
+        );
+        thread[0] = i_closure[0];
+        if (!slots)
+        {
+            if (!marker_count) continue;
+            for (i = 0; i < n && ss[i] != 0; i++);
+            REX_MEMCPY(thread + 1, i < n ? &i_str_pos : &start, 
+                sizeof(size_t));
+            continue;
+        }
+        /* Threads share the slot until an SS moves a marker */
+        markers = rex_vm_slot_markers(io_vm, slot);
+        for (
+            i = 0; 
+            i < n && (ss[i] >= marker_count || markers[ss[i]] == i_str_pos);
+            i++
+        );
+        if (i == n)
+        {
+            io_vm->slot_refs[slot]++;
+            thread[1] = slot;
+            continue;
+        }
+        copy = rex_vm_slot_alloc(io_vm);
+        if (copy == REX_VM_SLOT_NONE)
+        {
+            io_threadlist->thread_count--;
+            rex_vm_slot_release(io_vm, slot);
+            return REX_OUT_OF_MEMORY;
+        }
+        REX_MEMCPY(
+            rex_vm_slot_markers(io_vm, copy),
+            markers,
+            sizeof(size_t) * marker_count
+        );
+        markers = rex_vm_slot_markers(io_vm, copy);
+        for (; i < n; i++) 
+            if (ss[i] < marker_count) markers[ss[i]] = i_str_pos;
+        thread[1] = copy;
+    }
+    /* Adding the node again would add nothing */
+    rex_vm_threadlist_visit(io_threadlist, i_pc);
+    if (slots) rex_vm_slot_release(io_vm, slot);
+    return REX_SUCESS;
+}
+
+/* Adds the thread i_pc and every thread reachable from it without consuming
+ * a codepoint to io_threadlist
+ *
+ * J, B, BWP, SS and the assertions are resolved here, so only halt chains
+ * and M are left in a thread list.
+ * Threads are appended in the order a recursive expansion would reach them.
+ * The branch not taken first is kept on an explicit stack in VM memory,
+ * so no thread already in the list is ever moved.
+ *
+ * Arguments:
+ *      i_from:      thread advanced to i_pc, whose slot reference is taken
+ *                   over, NULL starts a fresh thread at i_pos
+ *      i_pos:       string index the thread is positioned at
+ *      i_prev_word: if the codepoint before i_pos is a word character
+ */
+static int
+rex_vm_thread_add(
+    rex_vm_t * const io_vm,
+    rex_vm_threadlist_t * const io_threadlist,
+    const void * const i_from,
+    const uint32_t i_pc,
+    const size_t i_pos,
+    const uint8_t i_prev_word
+){
+    uint8_t * const stack = io_vm->stack;
+    const size_t thread_sz = io_vm->thread_sz;
+    const size_t marker_count = io_threadlist->marker_count;
+    const int slots = REX_VM_USES_SLOTS(marker_count);
+    const size_t str_pos = io_vm->string_offset + i_pos;
+    const uint32_t * closure;
+    size_t * markers;
+    size_t sp = 0;
+    uint32_t * pc;
+    uint32_t inst, imm, slot;
+    uint8_t next_word, at_end;
+
+    if (i_pc >= io_vm->prog_sz) return REX_BAD_INSTRUCTION;
+    if (rex_vm_threadlist_contains(io_threadlist, i_pc))
+    {
+        if (slots && i_from) 
+            rex_vm_slot_release(io_vm, REX_VM_THREAD_SLOT(i_from));
+        return REX_SUCESS;
+    }
+
+    at_end = i_pos == io_vm->string_sz || io_vm->string[i_pos] == 0;
+    next_word = at_end ? 0 : REX_ISWORD(io_vm->string[i_pos]);
+
+    if (io_vm->closures)
+    {
+        closure = rex_closures_find(
+            io_vm->closures,
+            i_pc,
+            rex_vm_facts(io_vm, i_pos, i_prev_word)
+        );
+        if (closure) 
+            return rex_vm_closure_add(io_vm, io_threadlist, i_from, i_pc,
+                closure, str_pos);
+    }
+
+    /* The thread being expanded lives in the first unused list slot */
+    pc = rex_vm_thread_by_index(io_threadlist, io_threadlist->thread_count);
+    pc[0] = i_pc;
+    if (i_from)
+    {
+        REX_MEMCPY(pc + 1, (const uint32_t *) i_from + 1, 
+            thread_sz - sizeof(uint32_t));
+    }else if (!slots){
+        if (marker_count) REX_MEMCPY(pc + 1, &str_pos, sizeof(size_t));
+    }else{
+        pc[1] = rex_vm_slot_alloc(io_vm);
+        if (pc[1] == REX_VM_SLOT_NONE) return REX_OUT_OF_MEMORY;
+        markers = rex_vm_slot_markers(io_vm, pc[1]);
+        REX_MEMSET(markers, 0xFF, sizeof(size_t) * marker_count);
+        markers[0] = str_pos;
+    }
+
+    for (;;)
+    {
+        if (*pc >= io_vm->prog_sz) return REX_BAD_INSTRUCTION;
+        /* A higher priority thread already reached this pc */
+        if (!rex_vm_threadlist_visit(io_threadlist, *pc)) goto thread_drop;
+        inst = io_vm->prog[*pc];
+        imm = REX_IMM_FROM_INST(inst);
+        switch (REX_OP_FROM_INST(inst))
+        {
+        case REX_OPCODE_J:
+            *pc = imm;
+            continue;
+        case REX_OPCODE_B:
+            /* Continue first, branch once this thread is resolved */
+            if (imm < io_vm->prog_sz && 
+                    rex_vm_threadlist_contains(io_threadlist, imm))
+            {
+                ++*pc;
+                continue;
+            }
+            REX_MEMCPY(stack + sp * thread_sz, pc, thread_sz);
+            *(uint32_t *)(stack + sp++ * thread_sz) = imm;
+            if (slots) io_vm->slot_refs[pc[1]]++;
+            ++*pc;
+            continue;
+        case REX_OPCODE_BWP:
+            /* Branch first, continue once this thread is resolved */
+            if (!rex_vm_threadlist_contains(io_threadlist, *pc + 1))
+            {
+                REX_MEMCPY(stack + sp * thread_sz, pc, thread_sz);
+                ++*(uint32_t *)(stack + sp++ * thread_sz);
+                if (slots) io_vm->slot_refs[pc[1]]++;
+            }
+            *pc = imm;
+            continue;
+        case REX_OPCODE_SS:
+            ++*pc;
+            /* Groups the caller does not read are not saved */
+            if (imm >= marker_count) continue;
+            if (!slots)
+            {
+                /* The match end is taken at M */
+                if (imm == 0) REX_MEMCPY(pc + 1, &str_pos, sizeof(size_t));
+                continue;
+            }
+            markers = rex_vm_slot_markers(io_vm, pc[1]);
+            if (markers[imm] == str_pos) continue;
+            if (io_vm->slot_refs[pc[1]] > 1)
+            {
+                /* Copy on write */
+                slot = rex_vm_slot_alloc(io_vm);
+                if (slot == REX_VM_SLOT_NONE) return REX_OUT_OF_MEMORY;
+                REX_MEMCPY(
+                    rex_vm_slot_markers(io_vm, slot),
+                    markers,
+                    sizeof(size_t) * marker_count
+                );
+                io_vm->slot_refs[pc[1]]--;
+                pc[1] = slot;
+                markers = rex_vm_slot_markers(io_vm, slot);
+            }
+            markers[imm] = str_pos;
+            continue;
+        case REX_OPCODE_AS:
+            if (i_pos != 0) goto thread_drop;
+            ++*pc;
+            continue;
+        case REX_OPCODE_AE:
+            if (!at_end) goto thread_drop;
+            ++*pc;
+            continue;
+        case REX_OPCODE_AWB:
+            if (i_prev_word == next_word) goto thread_drop;
+            ++*pc;
+            continue;
+        case REX_OPCODE_ANWB:
+            if (i_prev_word != next_word) goto thread_drop;
+            ++*pc;
+            continue;
+        default:
+            /* Thread waits for the next codepoint */
+            io_threadlist->thread_count++;
+            goto thread_pop;
+        }
+
+    thread_drop:
+        if (slots) rex_vm_slot_release(io_vm, pc[1]);
+    thread_pop:
+        for (;;)
+        {
+            if (sp == 0) return REX_SUCESS;
+            sp--;
+            pc = (uint32_t *)(stack + sp * thread_sz);
+            if (*pc >= io_vm->prog_sz || 
+                !rex_vm_threadlist_contains(io_threadlist, *pc)
+            ) break;
+            if (slots) rex_vm_slot_release(io_vm, pc[1]);
+        }
+        pc = rex_vm_thread_by_index(io_threadlist, io_threadlist->thread_count);
+        REX_MEMCPY(pc, stack + sp * thread_sz, thread_sz);
+    }
+}
+
+#ifdef REX_VM_THREADED
+/* Labels as values are a GCC extension */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+static int
+rex_vm_exec_thread(
+    rex_vm_t * io_vm
+){
+    
+#ifdef REX_VM_THREADED
+    static const void * const dispatch[256] = {
+        [REX_OPCODE_HI] = &&op_hi,
+        [REX_OPCODE_HIA] = &&op_hia,
+        [REX_OPCODE_HNI] = &&op_hni,
+        [REX_OPCODE_HNIA] = &&op_hnia,
+        [REX_OPCODE_HR] = &&op_hr,
+        [REX_OPCODE_HRA] = &&op_hra,
+        [REX_OPCODE_HNSA] = &&op_hnsa,
+        [REX_OPCODE_LR] = &&op_lr,
+        [REX_OPCODE_M] = &&op_m
+    };
+    const void * handler;
+    const rex_vm_op_t * op;
+#else
+    rex_instruction_t inst;
+    uint32_t imm;
+#endif
+    const uint32_t cp = io_vm->cp;
+    const size_t * markers;
+    size_t start, end, i;
+    int r;
+
+#ifdef REX_VM_THREADED
+    if (io_vm->decode)
+    {
+        /* Every other instruction is handled by thread add, and the one
+         * past the end stops a halt chain running off the program */
+        for (i = 0; i < io_vm->prog_sz; i++)
+        {
+            handler = dispatch[REX_OP_FROM_INST(io_vm->prog[i])];
+            io_vm->decode[i].handler = handler ? handler : &&op_bad;
+            io_vm->decode[i].imm = REX_IMM_FROM_INST(io_vm->prog[i]);
+        }
+        io_vm->decode[i].handler = &&op_bad;
+        io_vm->decode[i].imm = 0;
+        io_vm->ops = io_vm->decode;
+        io_vm->decode = NULL;
+    }
+    /* rex_vm_ops_compile only decodes */
+    if (io_vm->ti >= io_vm->clist.thread_count) return REX_SUCESS;
+#endif
+    io_vm->cthread = rex_vm_thread_by_index(&io_vm->clist, io_vm->ti);
+    io_vm->pc = *(uint32_t*) io_vm->cthread;
+
+#ifdef REX_VM_THREADED
+    op = io_vm->ops + io_vm->pc;
+    goto *op->handler;
+
+op_hi:
+    if (cp == op->imm) goto thread_halt;
+    op++;
+    goto *op->handler;
+op_hia:
+    if (cp == op->imm) goto thread_halt;
+    goto op_advance;
+op_hni:
+    if (cp != op->imm) goto thread_halt;
+    op++;
+    goto *op->handler;
+op_hnia:
+    if (cp != op->imm) goto thread_halt;
+    goto op_advance;
+op_hr:
+    if (cp >= op->imm && cp <= io_vm->rcp1) goto thread_halt;
+    op++;
+    goto *op->handler;
+op_hra:
+    if (cp >= op->imm && cp <= io_vm->rcp1) goto thread_halt;
+    goto op_advance;
+op_hnsa:
+    if (!rex_set_contains(io_vm->prog + io_vm->prog_sz + op->imm, cp))
+        goto thread_halt;
+    goto op_advance;
+op_lr:
+    io_vm->rcp1 = op->imm;
+    op++;
+    goto *op->handler;
+op_bad:
+    return REX_BAD_INSTRUCTION;
+op_m:
+    io_vm->pc = op - io_vm->ops;
+    goto thread_match;
+op_advance:
+    io_vm->pc = op - io_vm->ops;
+    goto thread_advance;
+#else
+
+/* Some instruction sequences are handled
+ * as if they were a single instruction
+ */
+thread_continue:
+    inst = io_vm->prog[io_vm->pc];
+
+    imm = REX_IMM_FROM_INST(inst);
+    switch (REX_OP_FROM_INST(inst))
+    {
+    case REX_OPCODE_HI:
+        if (cp == imm) goto thread_halt;
+        io_vm->pc++;
+        goto thread_continue;
+    case REX_OPCODE_HIA:
+        if (cp == imm) goto thread_halt;
+        goto thread_advance;
+    case REX_OPCODE_HNI:
+        if (cp != imm) goto thread_halt;
+        io_vm->pc++;
+        goto thread_continue;
+    case REX_OPCODE_HNIA:
+        if (cp != imm) goto thread_halt;
+        goto thread_advance;
+    case REX_OPCODE_HR:
+        if (cp >= imm && cp <= io_vm->rcp1) goto thread_halt;
+        io_vm->pc++;
+        goto thread_continue;
+    case REX_OPCODE_HRA:
+        if (cp >= imm && cp <= io_vm->rcp1) goto thread_halt;
+        goto thread_advance;
+    case REX_OPCODE_HNSA:
+        if (!rex_set_contains(io_vm->prog + io_vm->prog_sz + imm, cp))
+            goto thread_halt;
+        goto thread_advance;
+    case REX_OPCODE_LR:
+        io_vm->rcp1 = imm;
+        io_vm->pc++;
+        goto thread_continue;
+    case REX_OPCODE_SS:
+    case REX_OPCODE_B:
+    case REX_OPCODE_BWP:
+    case REX_OPCODE_J:
+    case REX_OPCODE_AWB:
+    case REX_OPCODE_ANWB:
+    case REX_OPCODE_AE:
+    case REX_OPCODE_AS:
+        /* Handled by thread add */
+        /*FALLTHROUGH*/
+    default:
+        return REX_BAD_INSTRUCTION;
 
     case REX_OPCODE_M:
-        io_vm->match = 1;
-        if (io_vm->clist.marker_count > 1)
-            REX_MARKERS(io_vm->cthread)[1] = io_vm->string + io_vm->cpi;
-        for (io_vm->mi = 0; io_vm->mi < io_vm->clist.marker_count; io_vm->mi+=2)
-            io_vm->matches[io_vm->mi/2] = 
-                (rex_match_t){
-                    REX_MARKERS(io_vm->cthread)[io_vm->mi],
-                    REX_MARKERS(io_vm->cthread)[io_vm->mi + 1] - REX_MARKERS(io_vm->cthread)[io_vm->mi]
-            };
-        io_vm->ti = SIZE_MAX;
+        goto thread_match;
+    } 
+#endif
+
+thread_halt:
+    io_vm->ti++;
+    return REX_SUCESS;
+
+thread_match:
+    io_vm->match = 1;
+    io_vm->ti = SIZE_MAX;
+    end = io_vm->string_offset + io_vm->cpi;
+    if (io_vm->clist.marker_count == 0) return REX_SUCESS;
+    if (!REX_VM_USES_SLOTS(io_vm->clist.marker_count))
+    {
+        REX_MEMCPY(&start, (uint32_t *) io_vm->cthread + 1, sizeof(size_t));
+        rex_vm_match_save(io_vm, 0, start, end);
+        return REX_SUCESS;
+    }
+    /* The slot can be shared so the end of the match is not saved */
+    markers = rex_vm_slot_markers(
+        io_vm, 
+        REX_VM_THREAD_SLOT(io_vm->cthread)
+    );
+    rex_vm_match_save(io_vm, 0, markers[0], end);
+    for (i = 2; i < io_vm->clist.marker_count; i += 2)
+        rex_vm_match_save(io_vm, i / 2, markers[i], markers[i + 1]);
+    return REX_SUCESS;
+
+thread_advance:
+    r = rex_vm_thread_add(
+        io_vm,
+        &io_vm->nlist, 
+        io_vm->cthread,
+        io_vm->pc + 1,
+        io_vm->cpi + io_vm->l,
+        REX_ISWORD(cp)
+    );
+    /* The advanced thread took over the slot, so saving a marker after
+     * the halt does not copy it */
+    if (REX_VM_USES_SLOTS(io_vm->clist.marker_count))
+        REX_VM_THREAD_SLOT(io_vm->cthread) = REX_VM_SLOT_NONE;
+    if (r) return r;
+    io_vm->ti++;
+    return REX_SUCESS;
+}
+
+#ifdef REX_VM_THREADED
+#pragma GCC diagnostic pop
+#endif
+
+
+/* Returns the first position at or after i_pos the literal or an arm
+ * of the literal set starts at, or SIZE_MAX if there is none */
+static inline size_t
+rex_vm_prefilter_find(
+    const rex_literal_t * const i_literal,
+    const rex_aho_corasick_t * const i_literal_set,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_pos
+){
+    size_t start, end;
+    if (!i_literal_set)
+        return rex_literal_find(i_literal, i_string, i_string_sz, i_pos);
+    rex_aho_corasick_find(
+        i_literal_set,
+        i_string,
+        i_string_sz,
+        i_pos,
+        &start,
+        &end
+    );
+    return start;
+}
+
+/* 
+ * Returns the first position at or after i_pos a match can start at
+ * or SIZE_MAX if there is none
+ * io_next is the result of rex_vm_prefilter_find for a previous i_pos
+ * and is moved forward as needed
+ */
+static inline size_t
+rex_vm_restart(
+    const rex_literal_t * const i_literal,
+    const rex_aho_corasick_t * const i_literal_set,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_pos,
+    size_t * const io_next
+){
+    if (*io_next < i_pos)
+        *io_next = rex_vm_prefilter_find(
+            i_literal,
+            i_literal_set,
+            i_string,
+            i_string_sz,
+            i_pos
+        );
+    if (i_literal_set) return *io_next;
+    return rex_literal_restart(i_literal, i_string, i_pos, *io_next);
+}
+
+/* 
+ * Decodes the codepoint at io_vm->cpi into io_vm->cp and io_vm->l
+ * Runs of ASCII are found ahead so most codepoints are a single load
+ */
+static inline void
+rex_vm_decode(
+    rex_vm_t * io_vm
+){
+    if (io_vm->bytes)
+    {
+        io_vm->l = io_vm->cpi < io_vm->string_sz;
+        if (io_vm->l) io_vm->cp = (uint8_t) io_vm->string[io_vm->cpi];
+        return;
+    }
+    if (io_vm->cpi >= io_vm->ascii_end && 
+        io_vm->cpi < io_vm->string_sz &&
+        (uint8_t) io_vm->string[io_vm->cpi] < 0x80
+    ) io_vm->ascii_end = io_vm->cpi + rex_ascii_run(
+        io_vm->simd,
+        io_vm->string,
+        io_vm->string_sz,
+        io_vm->cpi,
+        &io_vm->ascii_checked
+    );
+    if (io_vm->cpi < io_vm->ascii_end)
+    {
+        io_vm->cp = (uint8_t) io_vm->string[io_vm->cpi];
+        io_vm->l = 1;
+        return;
+    }
+    io_vm->l = rex_parse_utf8_codepoint(
+        io_vm->string + io_vm->cpi,
+        io_vm->string_sz - io_vm->cpi,
+        &io_vm->cp
+    );
+}
+
+/* 
+ * Returns non zero if an unanchored search can start at i_pos
+ * A byte program only starts where a codepoint does, so that it matches
+ * at the same offsets as the program it was compiled from
+ */
+static inline int
+rex_vm_starts_at(
+    const rex_vm_t * const i_vm,
+    const size_t i_pos
+){
+    return !i_vm->bytes || i_pos >= i_vm->string_sz ||
+        !REX_UTF8_IS_TAIL((uint8_t) i_vm->string[i_pos]);
+}
+
+/* 
+ * Moves an unanchored search with no threads left to i_pos
+ * and restarts the program there, SIZE_MAX halts it
+ */
+static int
+rex_vm_exec_skip(
+    rex_vm_t * io_vm,
+    const size_t i_pos
+){
+    rex_vm_threadlist_release(io_vm, &io_vm->clist);
+    rex_vm_threadlist_release(io_vm, &io_vm->nlist);
+    if (i_pos == SIZE_MAX || i_pos > io_vm->string_stop)
+    {
+        io_vm->halted = 1;
+        return REX_SUCESS;
+    }
+
+    io_vm->cpi = i_pos;
+    rex_vm_decode(io_vm);
+    io_vm->ti = 0;
+    /* Can look back one byte as any valid unicode byte will return false */
+    return rex_vm_thread_add(
+        io_vm,
+        &io_vm->clist,
+        NULL,
+        0,
+        io_vm->cpi,
+        REX_ISWORD(io_vm->string[io_vm->cpi - 1])
+    );
+}
+
+static int
+rex_vm_exec_step(
+    rex_vm_t * io_vm
+){
+    rex_vm_threadlist_t tmp;
+    size_t restart;
+    int r;
+    if(io_vm->ti < io_vm->clist.thread_count)
+    {
+        return rex_vm_exec_thread(io_vm);
+    }
+
+    /* Until a match is found an unanchored search restarts the program 
+     * at every position with the lowest priority */
+    if (io_vm->unanchored && !io_vm->match && io_vm->cp != 0 && io_vm->l != 0)
+    {
+        restart = io_vm->cpi + io_vm->l;
+        if (io_vm->literal || io_vm->literal_set)
+        {
+            restart = rex_vm_restart(
+                io_vm->literal,
+                io_vm->literal_set,
+                io_vm->string,
+                io_vm->string_sz,
+                io_vm->cpi + io_vm->l,
+                &io_vm->literal_next
+            );
+            if (restart != io_vm->cpi + io_vm->l && 
+                io_vm->nlist.thread_count == 0
+            ) return rex_vm_exec_skip(io_vm, restart);
+        }
+        if (restart == io_vm->cpi + io_vm->l && 
+            rex_vm_starts_at(io_vm, restart)
+        ){
+            r = rex_vm_thread_add(
+                io_vm,
+                &io_vm->nlist,
+                NULL,
+                0,
+                io_vm->cpi + io_vm->l,
+                REX_ISWORD(io_vm->cp)
+            );
+            if (r) return r;
+        }
+    }
+    
+    /* Swap clist and nlist */
+    tmp = io_vm->clist;
+    io_vm->clist = io_vm->nlist;
+    io_vm->nlist = tmp;
+    rex_vm_threadlist_release(io_vm, &io_vm->nlist);
+    if (io_vm->cp == 0 || io_vm->l == 0 || io_vm->cpi >= io_vm->string_stop)
+    {
+        io_vm->halted = 1;
+        return REX_SUCESS;
+    };
+
+    io_vm->cpi += io_vm->l;
+
+    rex_vm_decode(io_vm);
+    if (io_vm->l == 0 && io_vm->string_sz - io_vm->cpi != 0) io_vm->halted =1;
+    /* TODO:
+     * If we dont want it to be halted after finishing prog
+     * maybe remove? */
+    if (io_vm->clist.thread_count == 0 && 
+            (io_vm->match || !io_vm->unanchored)) io_vm->halted =1;
+
+    io_vm->ti = 0;
+
+    return REX_SUCESS;
+}
+static int
+rex_vm_exec_init(
+    rex_vm_t * o_vm,
+    void * i_memory,
+    size_t i_memory_sz,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const size_t i_string_stop,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_match_t * o_matches,
+    size_t i_matches_sz,
+    const int i_flags,
+    const rex_closures_t * const i_closures,
+    const rex_vm_ops_t * const i_ops
+    ){
+    const uint32_t * closure;
+    int r;
+    if (!o_vm || !i_string || !i_prog ) return REX_BAD_PARAM;
+    
+    if (rex_vm_memory_sz(i_prog_sz, i_matches_sz) > i_memory_sz)
+        return REX_OUT_OF_MEMORY;
+
+    REX_MEMSET(o_vm, 0, sizeof(rex_vm_t));
+    o_vm->memory = i_memory;
+    o_vm->memory_sz = i_memory_sz;
+    o_vm->string = i_string;
+    /*TODO: Did not halt on string_sz 0 */
+    o_vm->string_sz = i_string_sz;
+    o_vm->string_start = i_string_start;
+    o_vm->string_stop = i_string_stop;
+    o_vm->cpi = i_string_start;
+    o_vm->prog = i_prog;
+    o_vm->prog_sz = i_prog_sz;
+    o_vm->thread_sz = REX_VM_THREAD_SZ(i_matches_sz * 2);
+    o_vm->matches = o_matches;
+    o_vm->matches_sz = i_matches_sz;
+    o_vm->unanchored = (i_flags & REX_VM_UNANCHORED) != 0;
+    o_vm->bytes = (i_flags & REX_VM_BYTES) != 0;
+    o_vm->closures = i_closures;
+    o_vm->simd = rex_simd_level();
+
+    if (o_matches) REX_MEMSET(o_matches, 0, sizeof(rex_match_t)*i_matches_sz);
+
+    /* Can look back one byte as any valid unicode byte will return false */
+    o_vm->prev_word = 
+        o_vm->cpi == 0 ? 0 : REX_ISWORD(o_vm->string[o_vm->cpi - 1]);
+
+
+    /* See rex_vm_memory_sz for the layout */
+#ifdef REX_VM_THREADED
+    o_vm->decode = rex_vm_ops_align(o_vm->memory);
+    o_vm->clist.sparse = (uint32_t *)(o_vm->decode + i_prog_sz + 1);
+    if (i_ops)
+    {
+        o_vm->ops = i_ops->op;
+        o_vm->decode = NULL;
+    }
+#else
+    (void) i_ops;
+    o_vm->clist.sparse = o_vm->memory;
+#endif
+    o_vm->clist.dense = o_vm->clist.sparse + i_prog_sz;
+    o_vm->nlist.sparse = o_vm->clist.dense + i_prog_sz;
+    o_vm->nlist.dense = o_vm->nlist.sparse + i_prog_sz;
+    /* Not required by the sparse set but keeps reads defined */
+    REX_MEMSET(o_vm->clist.sparse, 0, sizeof(uint32_t) * i_prog_sz);
+    REX_MEMSET(o_vm->nlist.sparse, 0, sizeof(uint32_t) * i_prog_sz);
+
+    o_vm->clist.buffer = o_vm->nlist.dense + i_prog_sz;
+    o_vm->clist.thread_count = 0;
+    o_vm->clist.marker_count = o_vm->matches_sz * 2;
+
+    o_vm->nlist.buffer = ((uint8_t*)o_vm->clist.buffer) + 
+        o_vm->thread_sz * i_prog_sz;
+    o_vm->nlist.thread_count = 0;
+    o_vm->nlist.marker_count = o_vm->matches_sz * 2;
+
+    o_vm->stack = ((uint8_t*)o_vm->nlist.buffer) + 
+        o_vm->thread_sz * i_prog_sz;
+
+    o_vm->slots = (size_t *)(((uint8_t*)o_vm->stack) + 
+        o_vm->thread_sz * i_prog_sz);
+    o_vm->slot_refs = (uint32_t *)(o_vm->slots + 
+        REX_VM_SLOT_COUNT(i_prog_sz) * o_vm->clist.marker_count);
+    o_vm->slot_free = REX_VM_SLOT_NONE;
+    o_vm->slot_next = 0;
+    o_vm->slot_max = REX_VM_SLOT_COUNT(i_prog_sz);
+
+    o_vm->cthread = o_vm->clist.buffer;
+
+    /* Put a thread with pc = 0, copied from its closure when there is one */
+    closure = i_closures ? rex_closures_find(
+        i_closures,
+        0, 
+        rex_vm_facts(o_vm, o_vm->cpi, o_vm->prev_word)
+    ) : NULL;
+    r = closure ? 
+        rex_vm_closure_start(
+            o_vm, 
+            &o_vm->clist, 
+            closure, 
+            o_vm->string_offset + o_vm->cpi
+        ) :
+        rex_vm_thread_add(
+            o_vm,
+            &o_vm->clist, 
+            NULL,
+            0,
+            o_vm->cpi,
+            o_vm->prev_word
+        );
+    if (r) return r;
+    rex_vm_decode(o_vm);
+    if (o_vm->l == 0 && i_string_sz - o_vm->cpi != 0) o_vm->halted =1;
+    /* TODO:
+     * If we dont want it to be halted after finishing prog
+     * maybe remove? */
+    if (o_vm->clist.thread_count == 0 && !o_vm->unanchored) o_vm->halted =1;
+    return REX_SUCESS;
+
+}
+
+/* PROGRAM ANALYSIS */
+
+#define REX_PC_HALTED (~(uint32_t)0)
+
+/* 
+ * Runs the halt chain at i_pc against i_cp without a VM
+ * Stores the pc following the advancing instruction in o_pc
+ * or REX_PC_HALTED if the chain halts
+ * Sets are read from the constant pool after the i_prog_sz instructions
+ * Returns REX_BAD_INSTRUCTION if i_pc does not start a halt chain
+ */
+static inline int
+rex_prog_chain_step(
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    uint32_t i_pc,
+    const uint32_t i_cp,
+    uint32_t * const o_pc
+){
+    uint32_t inst, imm;
+    uint32_t rcp1 = 0;
+    *o_pc = REX_PC_HALTED;
+    for (; i_pc < i_prog_sz; i_pc++)
+    {
+        inst = i_prog[i_pc];
+        imm = REX_IMM_FROM_INST(inst);
+        switch (REX_OP_FROM_INST(inst))
+        {
+        case REX_OPCODE_HI:
+            if (i_cp == imm) return REX_SUCESS;
+            continue;
+        case REX_OPCODE_HIA:
+            if (i_cp == imm) return REX_SUCESS;
+            break;
+        case REX_OPCODE_HNI:
+            if (i_cp != imm) return REX_SUCESS;
+            continue;
+        case REX_OPCODE_HNIA:
+            if (i_cp != imm) return REX_SUCESS;
+            break;
+        case REX_OPCODE_HR:
+            if (i_cp >= imm && i_cp <= rcp1) return REX_SUCESS;
+            continue;
+        case REX_OPCODE_HRA:
+            if (i_cp >= imm && i_cp <= rcp1) return REX_SUCESS;
+            break;
+        case REX_OPCODE_HNSA:
+            if (!rex_set_contains(i_prog + i_prog_sz + imm, i_cp)) 
+                return REX_SUCESS;
+            break;
+        case REX_OPCODE_LR:
+            rcp1 = imm;
+            continue;
+        default:
+            return REX_BAD_INSTRUCTION;
+        }
+        *o_pc = i_pc + 1;
+        return REX_SUCESS;
+    }
+    return REX_BAD_INSTRUCTION;
+}
+
+/* Worst case entry count of the o_bounds argument to rex_prog_classes */
+#define REX_PROG_CLASSES_MAX(prog_sz) ((prog_sz) * 2 + 12)
+
+/* 
+ * Splits the codepoints into classes that no instruction can tell apart
+ * o_bounds receives the first codepoint of every class in ascending order
+ * Returns the class count, or 0 if the program tests sets of a constant pool
+ * as their bounds are not limited by REX_PROG_CLASSES_MAX
+ *
+ * NUL always has its own class as it terminates strings.
+ * Word characters are split out when the program asserts word boundaries.
+ * i_bytes splits out the UTF-8 tail bytes for a byte program.
+ */
+static inline size_t
+rex_prog_classes(
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    const uint8_t i_bytes,
+    uint32_t * const o_bounds
+){
+    static const uint32_t word_bounds[8] = 
+        {'0', '9'+1, 'A', 'Z'+1, '_', '_'+1, 'a', 'z'+1};
+    size_t pc, i, j, n, gap;
+    uint32_t imm, tmp;
+    uint8_t word = 0;
+
+    n = 0;
+    o_bounds[n++] = 0;
+    o_bounds[n++] = 1;
+    if (i_bytes)
+    {
+        o_bounds[n++] = REX_UTF8_BYTE_MOST_SIGNIFICANT_BIT;
+        o_bounds[n++] = REX_UTF8_TAIL_BYTE_LEADING_BITMASK;
+    }
+    for (pc = 0; pc < i_prog_sz; pc++)
+    {
+        imm = REX_IMM_FROM_INST(i_prog[pc]);
+        switch (REX_OP_FROM_INST(i_prog[pc]))
+        {
+        case REX_OPCODE_HI:
+        case REX_OPCODE_HIA:
+        case REX_OPCODE_HNI:
+        case REX_OPCODE_HNIA:
+            o_bounds[n++] = imm;
+            o_bounds[n++] = imm + 1;
+            break;
+        case REX_OPCODE_HR:
+        case REX_OPCODE_HRA:
+            o_bounds[n++] = imm;
+            break;
+        case REX_OPCODE_LR:
+            o_bounds[n++] = imm + 1;
+            break;
+        case REX_OPCODE_HNSA:
+            return 0;
+        case REX_OPCODE_AWB:
+        case REX_OPCODE_ANWB:
+            if (word) break;
+            word = 1;
+            for (i = 0; i < 8; i++) o_bounds[n++] = word_bounds[i];
+            break;
+        default:
+            break;
+        }
+    }
+
+    /* Shell sort */
+    for (gap = n / 2; gap; gap /= 2)
+    {
+        for (i = gap; i < n; i++)
+        {
+            tmp = o_bounds[i];
+            for (j = i; j >= gap && o_bounds[j - gap] > tmp; j -= gap)
+                o_bounds[j] = o_bounds[j - gap];
+            o_bounds[j] = tmp;
+        }
+    }
+
+    /* Remove duplicates and values past the last codepoint */
+    for (i = 1, j = 1; i < n; i++)
+    {
+        if (o_bounds[i] > REX_MAX_UNICODE_VAL) break;
+        if (o_bounds[i] != o_bounds[j - 1]) o_bounds[j++] = o_bounds[i];
+    }
+    return j;
+}
+
+/* Returns the class of i_cp given the output of rex_prog_classes */
+static inline size_t
+rex_class_of(
+    const uint32_t * const i_bounds,
+    const size_t i_class_count,
+    const uint32_t i_cp
+){
+    size_t lo = 0;
+    size_t hi = i_class_count;
+    size_t mid;
+    while (hi - lo > 1)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (i_bounds[mid] <= i_cp) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* REX BYTE PROGRAMS */
+
+/*
+ * A byte program is run a byte at a time by the VM and the DFAs, so nothing
+ * is decoded while matching. rex_prog_bytes turns every halt chain of a
+ * program into an alternation of the UTF-8 byte sequences of the codepoints
+ * the chain lets through, split by rex_utf8_block so every sequence is a
+ * halt chain per byte. Everything else is copied with its jumps moved.
+ *
+ * Only the shortest encoding of a codepoint is matched. The codepoint VM
+ * halts at invalid UTF-8 while a byte program just does not match it.
+ */
+
+/* The instructions halt chains are made of, assertions also halt */
+#define REX_OP_IS_CHAIN(op) ((op) == REX_OPCODE_LR || \
+    ((op) & (REX_MICROCODE_HALT | REX_MICROCODE_ASSERT)) == REX_MICROCODE_HALT)
+/* Marks a pc of the original program in the middle of a halt chain */
+#define REX_PROG_BYTES_INSIDE (0xFFFFFFFF)
+/* Memory rex_prog_bytes needs for the pc map */
+#define REX_PROG_BYTES_MEMORY_SZ(prog_sz) (sizeof(uint32_t) * ((prog_sz) + 1))
+
+/* 
+ * Returns the first codepoint at or after i_cp the halt chain from i_pc to
+ * the advancing instruction i_end lets through
+ * or REX_UTF8_CODEPOINT_MAX + 1 if there is none
+ */
+static inline uint32_t
+rex_prog_chain_next(
+    const rex_instruction_t * const i_prog,
+    const size_t i_pc,
+    const size_t i_end,
+    uint32_t i_cp
+){
+    uint32_t imm, rcp1;
+    size_t pc;
+    int moved;
+
+    do
+    {
+        moved = 0;
+        rcp1 = 0;
+        for (pc = i_pc; pc <= i_end; pc++)
+        {
+            imm = REX_IMM_FROM_INST(i_prog[pc]);
+            switch (REX_OP_FROM_INST(i_prog[pc]))
+            {
+            case REX_OPCODE_LR:
+                rcp1 = imm;
+                break;
+            case REX_OPCODE_HI:
+            case REX_OPCODE_HIA:
+                if (i_cp != imm) break;
+                i_cp++;
+                moved = 1;
+                break;
+            case REX_OPCODE_HNI:
+            case REX_OPCODE_HNIA:
+                if (i_cp == imm) break;
+                i_cp = i_cp < imm ? imm : REX_UTF8_CODEPOINT_MAX + 1;
+                moved = 1;
+                break;
+            default:
+                if (i_cp < imm || i_cp > rcp1) break;
+                i_cp = rcp1 + 1;
+                moved = 1;
+                break;
+            }
+        }
+    } while (moved && i_cp <= REX_UTF8_CODEPOINT_MAX);
+    return REX_MIN(i_cp, REX_UTF8_CODEPOINT_MAX + 1);
+}
+
+/* Returns the last codepoint of the run the chain lets through from i_cp */
+static inline uint32_t
+rex_prog_chain_run_end(
+    const rex_instruction_t * const i_prog,
+    const size_t i_pc,
+    const size_t i_end,
+    const uint32_t i_cp
+){
+    uint32_t imm, rcp1, end;
+    size_t pc;
+
+    end = REX_UTF8_CODEPOINT_MAX;
+    rcp1 = 0;
+    for (pc = i_pc; pc <= i_end; pc++)
+    {
+        imm = REX_IMM_FROM_INST(i_prog[pc]);
+        switch (REX_OP_FROM_INST(i_prog[pc]))
+        {
+        case REX_OPCODE_LR:
+            rcp1 = imm;
+            break;
+        case REX_OPCODE_HI:
+        case REX_OPCODE_HIA:
+            if (imm > i_cp) end = REX_MIN(end, imm - 1);
+            break;
+        case REX_OPCODE_HNI:
+        case REX_OPCODE_HNIA:
+            end = REX_MIN(end, imm);
+            break;
+        default:
+            if (imm > i_cp && imm <= rcp1) end = REX_MIN(end, imm - 1);
+            break;
+        }
+    }
+    return end;
+}
+
+/* 
+ * Emits the halt chain letting the bytes [i_b0, i_b1] through at o_prog
+ * (NULLABLE) and returns its size
+ */
+static inline size_t
+rex_prog_bytes_range(
+    const uint8_t i_b0,
+    const uint8_t i_b1,
+    rex_instruction_t * const o_prog
+){
+    size_t sz = 0;
+    if (i_b0 == i_b1)
+    {
+        if (o_prog) o_prog[0] = REX_INSTRUCTION(REX_OPCODE_HNIA, i_b0);
+        return 1;
+    }
+    if (i_b0 == 0 && i_b1 == 0xFF)
+    {
+        /* No byte is 0x100 */
+        if (o_prog) o_prog[0] = REX_INSTRUCTION(REX_OPCODE_HIA, 0x100);
+        return 1;
+    }
+    if (i_b0 > 0)
+    {
+        if (o_prog)
+        {
+            o_prog[sz] = REX_INSTRUCTION(REX_OPCODE_LR, i_b0 - 1);
+            o_prog[sz + 1] = REX_INSTRUCTION(
+                i_b1 == 0xFF ? REX_OPCODE_HRA : REX_OPCODE_HR, 0);
+        }
+        sz += 2;
+    }
+    if (i_b1 < 0xFF)
+    {
+        if (o_prog)
+        {
+            o_prog[sz] = REX_INSTRUCTION(REX_OPCODE_LR, 0xFF);
+            o_prog[sz + 1] = REX_INSTRUCTION(REX_OPCODE_HRA, i_b1 + 1);
+        }
+        sz += 2;
+    }
+    return sz;
+}
+
+/* 
+ * Moves *io_cp to the next codepoint the chain from i_pc to i_end lets
+ * through and stores the end of its block in o_end
+ * Returns 0 when there is none
+ */
+static inline int
+rex_prog_chain_block(
+    const rex_instruction_t * const i_prog,
+    const size_t i_pc,
+    const size_t i_end,
+    uint32_t * const io_cp,
+    uint32_t * const o_end
+){
+    const uint32_t cp = rex_prog_chain_next(i_prog, i_pc, i_end, *io_cp);
+    if (cp > REX_UTF8_CODEPOINT_MAX) return 0;
+    *io_cp = cp;
+    *o_end = rex_utf8_block(
+        cp, 
+        rex_prog_chain_run_end(i_prog, i_pc, i_end, cp)
+    );
+    return 1;
+}
+
+/* 
+ * Emits the byte sequences of the chain from i_pc to i_end at i_base
+ * Every sequence but the last branches to the next one and jumps to
+ * i_next when done
+ * With o_prog NULL only the size is returned
+ */
+static inline size_t
+rex_prog_bytes_chain(
+    const rex_instruction_t * const i_prog,
+    const size_t i_pc,
+    const size_t i_end,
+    const uint32_t i_base,
+    const uint32_t i_next,
+    rex_instruction_t * const o_prog
+){
+    uint8_t b0[REX_UTF8_MULTIBYTE_MAX], b1[REX_UTF8_MULTIBYTE_MAX];
+    uint32_t cp, end;
+    size_t sz, count, branch, n, l, i;
+
+    /* NUL ends the string and is never consumed */
+    for (
+        cp = 1, count = 0;
+        rex_prog_chain_block(i_prog, i_pc, i_end, &cp, &end);
+        cp = end + 1
+    ) count++;
+    if (count == 0)
+    {
+        /* Nothing gets through */
+        if (o_prog)
+        {
+            o_prog[0] = REX_INSTRUCTION(REX_OPCODE_LR, REX_MAX_UNICODE_VAL);
+            o_prog[1] = REX_INSTRUCTION(REX_OPCODE_HRA, 0);
+        }
+        return 2;
+    }
+
+    sz = 0;
+    for (
+        cp = 1, n = 0;
+        rex_prog_chain_block(i_prog, i_pc, i_end, &cp, &end);
+        cp = end + 1, n++
+    ){
+        branch = sz;
+        if (n + 1 < count) sz++;
+        l = rex_encode_utf8_codepoint(cp, b0);
+        rex_encode_utf8_codepoint(end, b1);
+        for (i = 0; i < l; i++)
+            sz += rex_prog_bytes_range(
+                b0[i], 
+                b1[i], 
+                o_prog ? o_prog + sz : NULL
+            );
+        if (n + 1 == count) break;
+        if (o_prog)
+        {
+            o_prog[sz] = REX_INSTRUCTION(REX_OPCODE_J, i_next);
+            o_prog[branch] = REX_INSTRUCTION(REX_OPCODE_B, i_base + sz + 1);
+        }
+        sz++;
+    }
+    return sz;
+}
+
+/* 
+ * Stores the advancing instruction ending the halt chain at i_pc in o_end
+ * and marks the pcs after i_pc in io_pcs as inside the chain
+ * Returns REX_BAD_INSTRUCTION if the chain does not end in one
+ */
+static inline int
+rex_prog_chain_end(
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    const size_t i_pc,
+    uint32_t * const io_pcs,
+    size_t * const o_end
+){
+    size_t end = i_pc;
+    while (!(REX_OP_FROM_INST(i_prog[end]) & REX_MICROCODE_ADVANCE))
+    {
+        if (++end == i_prog_sz) return REX_BAD_INSTRUCTION;
+        io_pcs[end] = REX_PROG_BYTES_INSIDE;
+        if (!REX_OP_IS_CHAIN(REX_OP_FROM_INST(i_prog[end])))
+            return REX_BAD_INSTRUCTION;
+    }
+    *o_end = end;
+    return REX_SUCESS;
+}
+
+/* 
+ * Returns REX_UNSUPPORTED_PROGRAM if a jump lands inside a halt chain
+ * io_pcs are the pcs of the rewritten program or REX_PROG_BYTES_INSIDE
+ */
+static inline int
+rex_prog_jumps_check(
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    const uint32_t * const i_pcs
+){
+    size_t pc;
+    uint32_t imm;
+    for (pc = 0; pc < i_prog_sz; pc++)
+    {
+        if (i_pcs[pc] == REX_PROG_BYTES_INSIDE ||
+            !REX_INST_IS_JUMP_TYPE(i_prog[pc])) continue;
+        imm = REX_IMM_FROM_INST(i_prog[pc]);
+        if (imm > i_prog_sz || i_pcs[imm] == REX_PROG_BYTES_INSIDE)
+            return REX_UNSUPPORTED_PROGRAM;
+    }
+    return REX_SUCESS;
+}
+
+/* 
+ * Rewrites i_prog into a byte program, see REX BYTE PROGRAMS
+ * *io_prog_sz is the room in o_prog and receives the size of the byte
+ * program, with o_prog NULL only the size is computed
+ *
+ * Returns REX_UNSUPPORTED_PROGRAM if a jump lands inside a halt chain or
+ * the program tests sets, and REX_OUT_OF_MEMORY if o_prog or i_memory is
+ * too small
+ *
+ * Memory Layout
+ *
+ * uint32_t[prog_sz + 1] : pc in the byte program of every pc
+ */
+int
+rex_prog_bytes(
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    void * const i_memory,
+    const size_t i_memory_sz,
+    rex_instruction_t * const o_prog,
+    size_t * const io_prog_sz
+){
+    uint32_t * const pcs = i_memory;
+    size_t pc, end, sz;
+    uint32_t op, imm;
+    int r;
+
+    if (!i_prog || !i_memory || !io_prog_sz) return REX_BAD_PARAM;
+    if (REX_PROG_BYTES_MEMORY_SZ(i_prog_sz) > i_memory_sz) 
+        return REX_OUT_OF_MEMORY;
+
+    /* Lay out the byte program */
+    for (pc = 0, sz = 0; pc < i_prog_sz; pc = end + 1)
+    {
+        pcs[pc] = sz;
+        end = pc;
+        op = REX_OP_FROM_INST(i_prog[pc]);
+        if (op == REX_OPCODE_HNSA) return REX_UNSUPPORTED_PROGRAM;
+        if (!REX_OP_IS_CHAIN(op))
+        {
+            sz++;
+            continue;
+        }
+        r = rex_prog_chain_end(i_prog, i_prog_sz, pc, pcs, &end);
+        if (r) return r;
+        if (REX_OP_FROM_INST(i_prog[end]) == REX_OPCODE_HNSA)
+            return REX_UNSUPPORTED_PROGRAM;
+        sz += rex_prog_bytes_chain(i_prog, pc, end, 0, 0, NULL);
+    }
+    pcs[i_prog_sz] = sz;
+    r = rex_prog_jumps_check(i_prog, i_prog_sz, pcs);
+    if (r) return r;
+    if (sz > REX_PC_MAX) return REX_OUT_OF_MEMORY;
+    if (!o_prog)
+    {
+        *io_prog_sz = sz;
+        return REX_SUCESS;
+    }
+    if (sz > *io_prog_sz) return REX_OUT_OF_MEMORY;
+    *io_prog_sz = sz;
+
+    for (pc = 0; pc < i_prog_sz; pc = end + 1)
+    {
+        op = REX_OP_FROM_INST(i_prog[pc]);
+        imm = REX_IMM_FROM_INST(i_prog[pc]);
+        for (end = pc; end + 1 < i_prog_sz && 
+            pcs[end + 1] == REX_PROG_BYTES_INSIDE; end++);
+        switch (op)
+        {
+        case REX_OPCODE_J:
+        case REX_OPCODE_B:
+        case REX_OPCODE_BWP:
+            o_prog[pcs[pc]] = REX_INSTRUCTION(op, pcs[imm]);
+            break;
+        default:
+            if (!REX_OP_IS_CHAIN(op))
+            {
+                o_prog[pcs[pc]] = i_prog[pc];
+                break;
+            }
+            rex_prog_bytes_chain(
+                i_prog,
+                pc,
+                end,
+                pcs[pc],
+                pcs[end + 1],
+                o_prog + pcs[pc]
+            );
+            break;
+        }
+    }
+    return REX_SUCESS;
+}
+
+/* REX SET PROGRAMS */
+
+/*
+ * rex_prog_sets turns the long halt chains of a program into a single HNSA
+ * testing a set in the constant pool, so a codepoint costs one dispatch
+ * instead of one per range the chain excludes. Everything else is copied
+ * with its jumps moved.
+ */
+
+/* Halt chains at least this long are turned into sets */
+#define REX_PROG_SETS_CHAIN_MIN (3)
+/* Memory rex_prog_sets needs for the pc map */
+#define REX_PROG_SETS_MEMORY_SZ(prog_sz) REX_PROG_BYTES_MEMORY_SZ(prog_sz)
+
+/* 
+ * Returns the ranges past ASCII the chain from i_pc to i_end lets through
+ * and stores the set of the chain at o_set (NULLABLE)
+ */
+static inline size_t
+rex_prog_chain_set(
+    const rex_instruction_t * const i_prog,
+    const size_t i_pc,
+    const size_t i_end,
+    uint32_t * const o_set
+){
+    uint32_t cp, last;
+    size_t n;
+
+    if (o_set)
+    {
+        REX_MEMSET(o_set, 0, sizeof(uint32_t) * REX_SET_RANGES);
+        for (cp = 0; cp < 0x80; cp++)
+            if (rex_prog_chain_next(i_prog, i_pc, i_end, cp) == cp)
+                o_set[REX_SET_BITMAP + cp / 32] |= (uint32_t)1 << (cp % 32);
+    }
+    for (
+        cp = 0x80, n = 0;
+        (cp = rex_prog_chain_next(i_prog, i_pc, i_end, cp)) <= 
+            REX_UTF8_CODEPOINT_MAX;
+        cp = last + 1, n++
+    ){
+        last = rex_prog_chain_run_end(i_prog, i_pc, i_end, cp);
+        if (!o_set) continue;
+        o_set[REX_SET_RANGES + n * 2] = cp;
+        o_set[REX_SET_RANGES + n * 2 + 1] = last;
+    }
+    if (o_set) o_set[0] = n;
+    return n;
+}
+
+/* 
+ * Rewrites i_prog to test sets, see REX SET PROGRAMS
+ * *io_prog_sz is the room in o_prog for the program and its constant pool
+ * and receives the size of the program, o_pool_sz receives the size of the
+ * pool placed after it. With o_prog NULL only the sizes are computed
+ *
+ * Returns REX_UNSUPPORTED_PROGRAM if a jump lands inside a halt chain or
+ * the program already tests sets, and REX_OUT_OF_MEMORY if o_prog or
+ * i_memory is too small
+ *
+ * Memory Layout
+ *
+ * uint32_t[prog_sz + 1] : pc in the new program of every pc
+ */
+int
+rex_prog_sets(
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    void * const i_memory,
+    const size_t i_memory_sz,
+    rex_instruction_t * const o_prog,
+    size_t * const io_prog_sz,
+    size_t * const o_pool_sz
+){
+    uint32_t * const pcs = i_memory;
+    size_t pc, end, sz, pool, i;
+    uint32_t op, imm;
+    int r;
+
+    if (!i_prog || !i_memory || !io_prog_sz || !o_pool_sz) 
+        return REX_BAD_PARAM;
+    if (REX_PROG_SETS_MEMORY_SZ(i_prog_sz) > i_memory_sz) 
+        return REX_OUT_OF_MEMORY;
+
+    /* Lay out the program and its pool */
+    for (pc = 0, sz = 0, pool = 0; pc < i_prog_sz; pc = end + 1)
+    {
+        pcs[pc] = sz;
+        end = pc;
+        op = REX_OP_FROM_INST(i_prog[pc]);
+        if (op == REX_OPCODE_HNSA) return REX_UNSUPPORTED_PROGRAM;
+        if (!REX_OP_IS_CHAIN(op))
+        {
+            sz++;
+            continue;
+        }
+        r = rex_prog_chain_end(i_prog, i_prog_sz, pc, pcs, &end);
+        if (r) return r;
+        if (REX_OP_FROM_INST(i_prog[end]) == REX_OPCODE_HNSA)
+            return REX_UNSUPPORTED_PROGRAM;
+        if (end - pc + 1 < REX_PROG_SETS_CHAIN_MIN)
+        {
+            /* Copied as is so every pc of the chain can be jumped to */
+            for (i = pc + 1; i <= end; i++) pcs[i] = sz + i - pc;
+            sz += end - pc + 1;
+            continue;
+        }
+        sz++;
+        pool += REX_SET_SZ(rex_prog_chain_set(i_prog, pc, end, NULL));
+    }
+    pcs[i_prog_sz] = sz;
+    r = rex_prog_jumps_check(i_prog, i_prog_sz, pcs);
+    if (r) return r;
+    if (sz > REX_PC_MAX || pool > REX_NORMAL_IMM_MASK) 
+        return REX_OUT_OF_MEMORY;
+    *o_pool_sz = pool;
+    if (!o_prog)
+    {
+        *io_prog_sz = sz;
+        return REX_SUCESS;
+    }
+    if (sz + pool > *io_prog_sz) return REX_OUT_OF_MEMORY;
+    *io_prog_sz = sz;
+
+    for (pc = 0, pool = 0; pc < i_prog_sz; pc = end + 1)
+    {
+        op = REX_OP_FROM_INST(i_prog[pc]);
+        imm = REX_IMM_FROM_INST(i_prog[pc]);
+        for (end = pc; end + 1 < i_prog_sz && 
+            pcs[end + 1] == REX_PROG_BYTES_INSIDE; end++);
+        switch (op)
+        {
+        case REX_OPCODE_J:
+        case REX_OPCODE_B:
+        case REX_OPCODE_BWP:
+            o_prog[pcs[pc]] = REX_INSTRUCTION(op, pcs[imm]);
+            break;
+        default:
+            if (end == pc)
+            {
+                o_prog[pcs[pc]] = i_prog[pc];
+                break;
+            }
+            o_prog[pcs[pc]] = REX_INSTRUCTION(REX_OPCODE_HNSA, pool);
+            pool += REX_SET_SZ(
+                rex_prog_chain_set(i_prog, pc, end, o_prog + sz + pool)
+            );
+            break;
+        }
+    }
+    return REX_SUCESS;
+}
+
+/* REX PROGRAM OPTIMIZER */
+
+/*
+ * rex_prog_optimize is a peephole pass over a compiled program. Jumps are
+ * threaded to where a thread ends up, so a J to a J or a B to a J costs one
+ * dispatch, and a J to M becomes M. Branches whose arms land at the same pc
+ * become jumps, jumps to the next instruction are dropped along with code no
+ * thread can reach, and halt chains are rewritten with the fewest halts
+ * excluding the same codepoints, which drops repeated LR loads and merges
+ * ranges that touch. Everything left is renumbered.
+ *
+ * Matches and submatches are the same as those of the original program.
+ */
+
+/* Memory rex_prog_optimize needs for the pc map and its work arrays */
+#define REX_PROG_OPTIMIZE_MEMORY_SZ(prog_sz) \
+    (sizeof(uint32_t) * ((prog_sz) * 3 + 1))
+/* Flags of the pcs of the original program */
+#define REX_PROG_OPTIMIZE_KEEP (1)
+#define REX_PROG_OPTIMIZE_TARGET (2)
+#define REX_PROG_OPTIMIZE_INSIDE (4)
+
+/* 
+ * Returns the pc a thread reaching i_pc ends up at after its jumps
+ * A cycle of jumps is left as it is
+ */
+static inline uint32_t
+rex_prog_jump_resolve(
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    uint32_t i_pc
+){
+    size_t n;
+    for (
+        n = 0;
+        i_pc < i_prog_sz && n < i_prog_sz && 
+            REX_OP_FROM_INST(i_prog[i_pc]) == REX_OPCODE_J;
+        n++
+    ) i_pc = REX_IMM_FROM_INST(i_prog[i_pc]);
+    return i_pc;
+}
+
+/* 
+ * Returns the size of the shortest halt chain letting through what the
+ * chain from i_pc to i_end does and stores it at o_prog (NULLABLE)
+ * The chain must load R before testing a range
+ */
+static inline size_t
+rex_prog_chain_shortest(
+    const rex_instruction_t * const i_prog,
+    const size_t i_pc,
+    const size_t i_end,
+    rex_instruction_t * const o_prog
+){
+    uint32_t lo, cp, last;
+    size_t sz;
+
+    cp = rex_prog_chain_next(i_prog, i_pc, i_end, 0);
+    if (
+        cp <= REX_UTF8_CODEPOINT_MAX &&
+        rex_prog_chain_run_end(i_prog, i_pc, i_end, cp) == cp &&
+        rex_prog_chain_next(i_prog, i_pc, i_end, cp + 1) > 
+            REX_UTF8_CODEPOINT_MAX
+    ){
+        if (o_prog) o_prog[0] = REX_INSTRUCTION(REX_OPCODE_HNIA, cp);
+        return 1;
+    }
+    /* Halt on every gap between the runs the chain lets through */
+    for (lo = 0, sz = 0; lo <= REX_UTF8_CODEPOINT_MAX; lo = last + 1)
+    {
+        cp = rex_prog_chain_next(i_prog, i_pc, i_end, lo);
+        if (cp > lo && cp - 1 == lo)
+        {
+            if (o_prog) o_prog[sz] = REX_INSTRUCTION(REX_OPCODE_HI, lo);
+            sz++;
+        }else if (cp > lo)
+        {
+            if (o_prog)
+            {
+                o_prog[sz] = REX_INSTRUCTION(REX_OPCODE_LR, cp - 1);
+                o_prog[sz + 1] = REX_INSTRUCTION(REX_OPCODE_HR, lo);
+            }
+            sz += 2;
+        }
+        if (cp > REX_UTF8_CODEPOINT_MAX) break;
+        last = rex_prog_chain_run_end(i_prog, i_pc, i_end, cp);
+    }
+    if (!sz)
+    {
+        /* Lets everything through, the range is empty */
+        if (o_prog)
+        {
+            o_prog[0] = REX_INSTRUCTION(REX_OPCODE_LR, 0);
+            o_prog[1] = REX_INSTRUCTION(REX_OPCODE_HR, 1);
+        }
+        sz = 2;
+    }
+    if (o_prog)
+    {
+        o_prog[sz - 1] = REX_INSTRUCTION(
+            REX_OP_FROM_INST(o_prog[sz - 1]) | REX_MICROCODE_ADVANCE,
+            REX_IMM_FROM_INST(o_prog[sz - 1])
+        );
+    }
+    return sz;
+}
+
+/* 
+ * Stores the advancing instruction ending the halt chain at i_pc in o_end
+ * Returns 0 if the chain is cut short or tests a range before loading R,
+ * as the R it tests is then the one left by another chain
+ */
+static inline int
+rex_prog_chain_loaded(
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    const size_t i_pc,
+    size_t * const o_end
+){
+    size_t end;
+    uint32_t op;
+    int loaded = 0;
+
+    for (end = i_pc; end < i_prog_sz; end++)
+    {
+        op = REX_OP_FROM_INST(i_prog[end]);
+        if (!REX_OP_IS_CHAIN(op)) return 0;
+        if (op == REX_OPCODE_LR) loaded = 1;
+        else if ((op & REX_MICROCODE_RANGE) && !loaded) return 0;
+        if (op & REX_MICROCODE_ADVANCE) break;
+    }
+    *o_end = end;
+    return end < i_prog_sz;
+}
+
+/* 
+ * Rewrites i_prog into a shorter program, see REX PROGRAM OPTIMIZER
+ * *io_prog_sz is the room in o_prog and receives the size of the new
+ * program, with o_prog NULL only the size is computed
+ *
+ * Returns REX_UNSUPPORTED_PROGRAM if a jump leaves the program or the
+ * program tests sets, and REX_OUT_OF_MEMORY if o_prog or i_memory is
+ * too small
+ *
+ * Memory Layout
+ *
+ * uint32_t[prog_sz + 1] : pc in the new program of every pc
+ * rex_instruction_t[prog_sz] : the program with its jumps threaded
+ * uint32_t[prog_sz] : the pcs left to visit then the flags of every pc
+ */
+int
+rex_prog_optimize(
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    void * const i_memory,
+    const size_t i_memory_sz,
+    rex_instruction_t * const o_prog,
+    size_t * const io_prog_sz
+){
+    uint32_t * const pcs = i_memory;
+    rex_instruction_t * const insts = pcs + i_prog_sz + 1;
+    uint32_t * const marks = insts + i_prog_sz;
+    size_t pc, end, sz, top, i;
+    uint32_t op, imm, next;
+
+    if (!i_prog || !i_memory || !io_prog_sz) return REX_BAD_PARAM;
+    if (REX_PROG_OPTIMIZE_MEMORY_SZ(i_prog_sz) > i_memory_sz) 
+        return REX_OUT_OF_MEMORY;
+
+    /* Thread the jumps */
+    for (pc = 0; pc < i_prog_sz; pc++)
+    {
+        op = REX_OP_FROM_INST(i_prog[pc]);
+        imm = REX_IMM_FROM_INST(i_prog[pc]);
+        insts[pc] = i_prog[pc];
+        if (op == REX_OPCODE_HNSA) return REX_UNSUPPORTED_PROGRAM;
+        if (!REX_INST_IS_JUMP_TYPE(i_prog[pc])) continue;
+        if (imm > i_prog_sz) return REX_UNSUPPORTED_PROGRAM;
+        imm = rex_prog_jump_resolve(i_prog, i_prog_sz, imm);
+        next = rex_prog_jump_resolve(i_prog, i_prog_sz, pc + 1);
+        if (op != REX_OPCODE_J && imm == next) op = REX_OPCODE_J;
+        if (
+            op == REX_OPCODE_J && imm < i_prog_sz && 
+            REX_OP_FROM_INST(i_prog[imm]) == REX_OPCODE_M
+        ) insts[pc] = i_prog[imm];
+        else insts[pc] = REX_INSTRUCTION(op, imm);
+    }
+
+    /* Mark the pcs a thread can reach */
+    REX_MEMSET(pcs, 0, sizeof(uint32_t) * (i_prog_sz + 1));
+    top = 0;
+    if (i_prog_sz) 
+    {
+        marks[top++] = 0;
+        pcs[0] = 1;
+    }
+    while (top)
+    {
+        pc = marks[--top];
+        op = REX_OP_FROM_INST(insts[pc]);
+        imm = REX_IMM_FROM_INST(insts[pc]);
+        if (REX_INST_IS_JUMP_TYPE(insts[pc]) && imm < i_prog_sz && !pcs[imm])
+        {
+            marks[top++] = imm;
+            pcs[imm] = 1;
+        }
+        if (
+            op != REX_OPCODE_J && op != REX_OPCODE_M && 
+            pc + 1 < i_prog_sz && !pcs[pc + 1]
+        ){
+            marks[top++] = pc + 1;
+            pcs[pc + 1] = 1;
+        }
+    }
+    for (pc = 0; pc < i_prog_sz; pc++)
+        marks[pc] = pcs[pc] ? REX_PROG_OPTIMIZE_KEEP : 0;
+    for (pc = 0; pc < i_prog_sz; pc++)
+    {
+        imm = REX_IMM_FROM_INST(insts[pc]);
+        if (
+            (marks[pc] & REX_PROG_OPTIMIZE_KEEP) && 
+            REX_INST_IS_JUMP_TYPE(insts[pc]) && imm < i_prog_sz
+        ) marks[imm] |= REX_PROG_OPTIMIZE_TARGET;
+    }
+
+    /* 
+     * Drop the jumps that land where they would fall through
+     * pcs holds the next pc kept at or after every pc
+     */
+    pcs[i_prog_sz] = i_prog_sz;
+    for (pc = i_prog_sz; pc--;)
+    {
+        pcs[pc] = pc;
+        imm = REX_IMM_FROM_INST(insts[pc]);
+        if (
+            !(marks[pc] & REX_PROG_OPTIMIZE_KEEP) || (
+                REX_INST_IS_JUMP_TYPE(insts[pc]) && 
+                imm > pc && pcs[imm] == pcs[pc + 1]
+            )
+        ){
+            marks[pc] &= ~REX_PROG_OPTIMIZE_KEEP;
+            pcs[pc] = pcs[pc + 1];
+        }
+    }
+
+    /* Lay out the new program */
+    for (pc = 0, sz = 0; pc < i_prog_sz; pc = end + 1)
+    {
+        end = pc;
+        if (!(marks[pc] & REX_PROG_OPTIMIZE_KEEP)) continue;
+        pcs[pc] = sz;
+        if (
+            !REX_OP_IS_CHAIN(REX_OP_FROM_INST(insts[pc])) ||
+            !rex_prog_chain_loaded(insts, i_prog_sz, pc, &end)
+        ){
+            end = pc;
+            sz++;
+            continue;
+        }
+        for (i = pc + 1; i <= end; i++)
+            if (marks[i] & REX_PROG_OPTIMIZE_TARGET) break;
+        if (
+            i <= end || 
+            rex_prog_chain_shortest(insts, pc, end, NULL) >= end - pc + 1
+        ){
+            /* Copied as is */
+            for (i = pc + 1; i <= end; i++) pcs[i] = sz + i - pc;
+            sz += end - pc + 1;
+            continue;
+        }
+        for (i = pc + 1; i <= end; i++) 
+        {
+            pcs[i] = sz;
+            marks[i] |= REX_PROG_OPTIMIZE_INSIDE;
+        }
+        sz += rex_prog_chain_shortest(insts, pc, end, NULL);
+    }
+    pcs[i_prog_sz] = sz;
+    for (pc = i_prog_sz; pc--;)
+        if (!(marks[pc] & REX_PROG_OPTIMIZE_KEEP)) pcs[pc] = pcs[pc + 1];
+    if (sz > REX_PC_MAX) return REX_OUT_OF_MEMORY;
+    if (!o_prog)
+    {
+        *io_prog_sz = sz;
+        return REX_SUCESS;
+    }
+    if (sz > *io_prog_sz) return REX_OUT_OF_MEMORY;
+    *io_prog_sz = sz;
+
+    for (pc = 0; pc < i_prog_sz; pc = end + 1)
+    {
+        end = pc;
+        if (
+            !(marks[pc] & REX_PROG_OPTIMIZE_KEEP) || 
+            (marks[pc] & REX_PROG_OPTIMIZE_INSIDE)
+        ) continue;
+        op = REX_OP_FROM_INST(insts[pc]);
+        imm = REX_IMM_FROM_INST(insts[pc]);
+        if (REX_INST_IS_JUMP_TYPE(insts[pc]))
+        {
+            o_prog[pcs[pc]] = REX_INSTRUCTION(op, pcs[imm]);
+            continue;
+        }
+        for (; end + 1 < i_prog_sz && 
+            (marks[end + 1] & REX_PROG_OPTIMIZE_INSIDE); end++);
+        if (end == pc) o_prog[pcs[pc]] = insts[pc];
+        else rex_prog_chain_shortest(insts, pc, end, o_prog + pcs[pc]);
+    }
+    return REX_SUCESS;
+}
+
+/* REX BIT-STATE BACKTRACKER */
+
+/*
+ * The backtracker runs threads depth first in priority order and the first
+ * thread to reach M wins, which is the match the VM reports. A bit per
+ * (pc, position) pair stops a thread from being run twice, so the work is
+ * bounded by prog_sz * (length + 1) and the job stack by the same count.
+ *
+ * Markers are shared by all threads. SS pushes a job restoring the previous
+ * value so markers are unwound when a thread fails.
+ *
+ * rex_vm_exec and rex_vm_search use it when the VM memory can hold the
+ * bitset for the length of the string.
+ */
+typedef struct rex_backtrack_job_s rex_backtrack_job_t;
+
+struct rex_backtrack_job_s
+{
+    /* pc or REX_BACKTRACK_RESTORE | marker */
+    uint32_t pc;
+    /* position or previous marker offset */
+    size_t pos;
+};
+
+#define REX_BACKTRACK_RESTORE   (0x80000000)
+#define REX_BACKTRACK_NULL      (SIZE_MAX)
+
+/* 
+ * Memory Layout
+ *
+ * char *[matches_sz * 2] : markers
+ * rex_backtrack_job_t[prog_sz * (length + 1) + 1] : job stack
+ * uint32_t[] : visited bitset, prog_sz * (length + 1) bits
+ */
+static inline size_t
+rex_backtrack_memory_sz(
+    const size_t i_prog_sz,
+    const size_t i_length,
+    const size_t i_matches_sz
+){
+    const size_t states = i_prog_sz * (i_length + 1);
+    return sizeof(char *) * i_matches_sz * 2 + 
+        sizeof(rex_backtrack_job_t) * (states + 1) +
+        sizeof(uint32_t) * ((states + 31) / 32);
+}
+
+/* 
+ * Returns the length of the string after i_string_start up to i_string_stop
+ * or SIZE_MAX if the backtracker does not fit in i_memory_sz
+ */
+static inline size_t
+rex_backtrack_length(
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const size_t i_string_stop,
+    const size_t i_prog_sz,
+    const size_t i_matches_sz,
+    const size_t i_memory_sz
+){
+    const size_t fixed = rex_backtrack_memory_sz(0, 0, i_matches_sz);
+    const size_t state_sz = sizeof(rex_backtrack_job_t) + 1;
+    size_t max_length, n;
+
+    if (i_prog_sz == 0 || fixed + 8 > i_memory_sz) return SIZE_MAX;
+    /* Conservative, checked below */
+    max_length = (i_memory_sz - fixed - 8) / state_sz / i_prog_sz;
+    if (max_length == 0) return SIZE_MAX;
+    max_length--;
+
+    for (n = 0; 
+        n <= max_length && i_string_start + n < i_string_sz && 
+        i_string_start + n < i_string_stop && i_string[i_string_start + n];
+        n++
+    );
+    if (n > max_length) return SIZE_MAX;
+    if (rex_backtrack_memory_sz(i_prog_sz, n, i_matches_sz) > i_memory_sz)
+        return SIZE_MAX;
+    return n;
+}
+
+/* 
+ * Threads are not run past i_string_start + i_length
+ * which is the end of the string or the stop position
+ */
+static int
+rex_backtrack_exec(
+    void * const i_memory,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const size_t i_length,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_match_t * const o_matches,
+    const size_t i_matches_sz,
+    const int i_flags,
+    const rex_literal_t * const i_literal,
+    const rex_aho_corasick_t * const i_literal_set,
+    int * const o_match_found
+){
+    const uint8_t * const str = (const uint8_t *) i_string;
+    const size_t marker_count = i_matches_sz * 2;
+    const size_t width = i_length + 1;
+    const size_t last = i_string_start + i_length;
+    const char ** const markers = i_memory;
+    rex_backtrack_job_t * const jobs = 
+        (rex_backtrack_job_t *)(markers + marker_count);
+    uint32_t * const visited = (uint32_t *)(jobs + i_prog_sz * width + 1);
+    size_t sp, pos, start, l, bit, mi, next;
+    uint32_t pc, inst, imm, cp;
+    uint8_t prev_word, next_word, at_end;
+    int r;
+
+    REX_MEMSET(
+        visited,
+        0,
+        sizeof(uint32_t) * ((i_prog_sz * width + 31) / 32)
+    );
+    REX_MEMSET(markers, 0, sizeof(char *) * marker_count);
+    if (o_matches)
+        REX_MEMSET(o_matches, 0, sizeof(rex_match_t) * i_matches_sz);
+    *o_match_found = 0;
+    if (i_literal || i_literal_set)
+        next = rex_vm_prefilter_find(
+            i_literal,
+            i_literal_set,
+            i_string,
+            i_string_sz,
+            i_string_start
+        );
+
+    for (start = i_string_start;;)
+    {
+        if (marker_count) markers[0] = i_string + start;
+        jobs[0].pc = 0;
+        jobs[0].pos = start;
+        sp = 1;
+        while (sp)
+        {
+            sp--;
+            pc = jobs[sp].pc;
+            pos = jobs[sp].pos;
+            if (pc & REX_BACKTRACK_RESTORE)
+            {
+                markers[pc & ~REX_BACKTRACK_RESTORE] = 
+                    pos == REX_BACKTRACK_NULL ? NULL : i_string + pos;
+                continue;
+            }
+
+            for (;;)
+            {
+                if (pc >= i_prog_sz) return REX_BAD_INSTRUCTION;
+                bit = pc * width + (pos - i_string_start);
+                if (visited[bit / 32] & ((uint32_t)1 << (bit % 32))) break;
+                visited[bit / 32] |= (uint32_t)1 << (bit % 32);
+
+                inst = i_prog[pc];
+                imm = REX_IMM_FROM_INST(inst);
+                at_end = pos >= i_string_sz || str[pos] == 0;
+                switch (REX_OP_FROM_INST(inst))
+                {
+                case REX_OPCODE_J:
+                    pc = imm;
+                    continue;
+                case REX_OPCODE_B:
+                    jobs[sp].pc = imm;
+                    jobs[sp++].pos = pos;
+                    pc++;
+                    continue;
+                case REX_OPCODE_BWP:
+                    jobs[sp].pc = pc + 1;
+                    jobs[sp++].pos = pos;
+                    pc = imm;
+                    continue;
+                case REX_OPCODE_SS:
+                    if (imm < marker_count)
+                    {
+                        jobs[sp].pc = REX_BACKTRACK_RESTORE | imm;
+                        jobs[sp++].pos = markers[imm] ? 
+                            (size_t)(markers[imm] - i_string) : 
+                            REX_BACKTRACK_NULL;
+                        markers[imm] = i_string + pos;
+                    }
+                    pc++;
+                    continue;
+                case REX_OPCODE_AS:
+                    if (pos != 0) break;
+                    pc++;
+                    continue;
+                case REX_OPCODE_AE:
+                    if (!at_end) break;
+                    pc++;
+                    continue;
+                case REX_OPCODE_AWB:
+                case REX_OPCODE_ANWB:
+                    /* Can look back one byte as any valid unicode byte will return false */
+                    prev_word = pos == 0 ? 0 : REX_ISWORD(str[pos - 1]);
+                    next_word = REX_ISWORD(str[pos]);
+                    if ((prev_word != next_word) != 
+                        (REX_OP_FROM_INST(inst) == REX_OPCODE_AWB)
+                    ) break;
+                    pc++;
+                    continue;
+                case REX_OPCODE_M:
+                    /* The VM stops before an invalid codepoint */
+                    if (!at_end && !(i_flags & REX_VM_BYTES) && 
+                        !rex_parse_utf8_codepoint(
+                            i_string + pos, i_string_sz - pos, &cp)
+                    ) break;
+                    *o_match_found = 1;
+                    if (marker_count > 1) markers[1] = i_string + pos;
+                    for (mi = 0; mi < marker_count; mi += 2)
+                        o_matches[mi / 2] = (rex_match_t){
+                            markers[mi],
+                            markers[mi + 1] - markers[mi]
+                        };
+                    return REX_SUCESS;
+                default:
+                    /* Nothing is consumed at the end */
+                    if (at_end) 
+                    {
+                        r = rex_prog_chain_step(i_prog, i_prog_sz, pc, 0, &imm);
+                        if (r) return r;
+                        break;
+                    }
+                    if (pos == last) break;
+                    l = 1;
+                    cp = str[pos];
+                    if (!(i_flags & REX_VM_BYTES))
+                        l = rex_parse_utf8_codepoint(
+                            i_string + pos,
+                            i_string_sz - pos,
+                            &cp
+                        );
+                    if (l == 0) break;
+                    r = rex_prog_chain_step(i_prog, i_prog_sz, pc, cp, &pc);
+                    if (r) return r;
+                    if (pc == REX_PC_HALTED) break;
+                    pos += l;
+                    continue;
+                }
+                break;
+            }
+        }
+
+        if (!(i_flags & REX_VM_UNANCHORED) || start == last) break;
+        l = (i_flags & REX_VM_BYTES) ? 1 : rex_parse_utf8_codepoint(
+            i_string + start,
+            i_string_sz - start,
+            &cp
+        );
+        if (l == 0) break;
+        start += l;
+        /* Byte programs start where codepoints do */
+        if (i_flags & REX_VM_BYTES)
+            while (start < last && REX_UTF8_IS_TAIL(str[start])) start++;
+        if (i_literal || i_literal_set)
+        {
+            start = rex_vm_restart(
+                i_literal,
+                i_literal_set,
+                i_string,
+                i_string_sz,
+                start,
+                &next
+            );
+            if (start == SIZE_MAX || start > last) break;
+        }
+    }
+    return REX_SUCESS;
+}
+
+/* 
+ * Runs the backtracker in place of the VM when it fits in the VM memory
+ * o_ran is set to 0 when the VM has to be used
+ */
+static int
+rex_vm_backtrack(
+    rex_vm_t * const io_vm,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const size_t i_string_stop,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_match_t * const o_matches,
+    const size_t i_matches_sz,
+    const int i_flags,
+    const rex_literal_t * const i_literal,
+    const rex_aho_corasick_t * const i_literal_set,
+    int * const o_match_found,
+    int * const o_ran
+){
+    size_t length;
+    int found, r;
+
+    *o_ran = 0;
+    /* The VM requirements are kept so errors do not depend on the string */
+    if (rex_vm_memory_sz(i_prog_sz, i_matches_sz) > io_vm->memory_sz)
+        return REX_OUT_OF_MEMORY;
+#ifdef REX_NO_BACKTRACK
+    return REX_SUCESS;
+#endif
+    length = rex_backtrack_length(
+        i_string,
+        i_string_sz,
+        i_string_start,
+        i_string_stop,
+        i_prog_sz,
+        i_matches_sz,
+        io_vm->memory_sz
+    );
+    if (length == SIZE_MAX) return REX_SUCESS;
+
+    *o_ran = 1;
+    r = rex_backtrack_exec(
+        io_vm->memory,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        length,
+        i_prog,
+        i_prog_sz,
+        o_matches,
+        i_matches_sz,
+        i_flags,
+        i_literal,
+        i_literal_set,
+        &found
+    );
+    if (o_match_found) *o_match_found = found;
+    return r;
+}
+
+/* 
+ * Runs the backtracker or the VM
+ * Threads are not run past i_string_stop
+ * i_flags holds REX_VM_UNANCHORED and REX_VM_BYTES
+ * An unanchored run only starts threads where i_literal or an arm of
+ * i_literal_set can be reached (NULLABLE)
+ * Threads are added from i_closures when given (NULLABLE)
+ * The program is run from i_ops when given instead of being decoded
+ * (NULLABLE)
+ */
+static int
+rex_vm_run(
+    rex_vm_t * io_vm,
+    const char * const i_string,
+    const size_t i_string_sz,
+    size_t i_string_start,
+    const size_t i_string_stop,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_match_t * o_matches,
+    size_t i_matches_sz,
+    const int i_flags,
+    const rex_literal_t * i_literal,
+    const rex_aho_corasick_t * i_literal_set,
+    const rex_closures_t * i_closures,
+    const rex_vm_ops_t * i_ops,
+    int * o_match_found
+){
+    size_t next = 0;
+    int r, ran;
+    if (!io_vm || !i_string || !i_prog ) return REX_BAD_PARAM;
+    if (!(i_flags & REX_VM_UNANCHORED) || (i_literal && i_literal->sz == 0))
+        i_literal = NULL;
+    if (!(i_flags & REX_VM_UNANCHORED)) i_literal_set = NULL;
+    if (i_literal || i_literal_set)
+    {
+        if (rex_vm_memory_sz(i_prog_sz, i_matches_sz) > io_vm->memory_sz)
+            return REX_OUT_OF_MEMORY;
+        next = rex_vm_prefilter_find(
+            i_literal,
+            i_literal_set,
+            i_string,
+            i_string_sz,
+            i_string_start
+        );
+        i_string_start = rex_vm_restart(
+            i_literal,
+            i_literal_set,
+            i_string,
+            i_string_sz,
+            i_string_start,
+            &next
+        );
+        if (i_string_start == SIZE_MAX || i_string_start > i_string_stop)
+        {
+            if (o_matches)
+                REX_MEMSET(o_matches, 0, sizeof(rex_match_t) * i_matches_sz);
+            if (o_match_found) *o_match_found = 0;
+            return REX_SUCESS;
+        }
+    }
+    /* The closures and ops are there to be used, the backtracker has no use
+     * of them */
+    if (!i_closures && !i_ops)
+    {
+        r = rex_vm_backtrack(
+            io_vm,
+            i_string,
+            i_string_sz,
+            i_string_start,
+            i_string_stop,
+            i_prog,
+            i_prog_sz,
+            o_matches,
+            i_matches_sz,
+            i_flags,
+            i_literal,
+            i_literal_set,
+            o_match_found,
+            &ran
+        );
+        if (r || ran) return r;
+    }
+
+    r = rex_vm_exec_init(
+        io_vm,
+        io_vm->memory,
+        io_vm->memory_sz,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        i_string_stop,
+        i_prog,
+        i_prog_sz,
+        o_matches,
+        i_matches_sz,
+        i_flags,
+        i_closures,
+        i_ops
+    );
+    if (r) return r;
+    io_vm->literal = i_literal;
+    io_vm->literal_set = i_literal_set;
+    io_vm->literal_next = next;
+
+    while (
+        (r = rex_vm_exec_step(io_vm))==0 && !io_vm->halted
+    );
+    if (o_match_found) *o_match_found = io_vm->match;
+
+    return r;
+}
+
+/* 
+ * NOTES:
+ * MARKER REGISTERS 0 and 1 are reserved for pattern match
+ * If i_matches_sz is greater than actual submatch count
+ * extra matches are undefined
+ */
+
+int
+rex_vm_exec(
+    rex_vm_t * io_vm,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_match_t * o_matches,
+    size_t i_matches_sz,
+    int * o_match_found
+)
+{
+    return rex_vm_run(
+        io_vm,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        SIZE_MAX,
+        i_prog,
+        i_prog_sz,
+        o_matches,
+        i_matches_sz,
+        0,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        o_match_found
+    );
+}
+
+/* 
+ * Finds the leftmost match starting at or after i_string_start
+ * Arguments and results are the same as rex_vm_exec
+ *
+ * The program is restarted at every position as if it began with a lazy .*?
+ * so the string is only scanned once
+ */
+int
+rex_vm_search(
+    rex_vm_t * io_vm,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_match_t * o_matches,
+    size_t i_matches_sz,
+    int * o_match_found
+)
+{
+    return rex_vm_run(
+        io_vm,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        SIZE_MAX,
+        i_prog,
+        i_prog_sz,
+        o_matches,
+        i_matches_sz,
+        1,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        o_match_found
+    );
+}
+
+/* 
+ * rex_vm_exec and rex_vm_search for a byte program from rex_prog_bytes
+ * Codepoints are not decoded so every position is a byte
+ */
+int
+rex_vm_exec_bytes(
+    rex_vm_t * io_vm,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_match_t * o_matches,
+    size_t i_matches_sz,
+    int * o_match_found
+)
+{
+    return rex_vm_run(
+        io_vm,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        SIZE_MAX,
+        i_prog,
+        i_prog_sz,
+        o_matches,
+        i_matches_sz,
+        REX_VM_BYTES,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        o_match_found
+    );
+}
+
+int
+rex_vm_search_bytes(
+    rex_vm_t * io_vm,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_match_t * o_matches,
+    size_t i_matches_sz,
+    int * o_match_found
+)
+{
+    return rex_vm_run(
+        io_vm,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        SIZE_MAX,
+        i_prog,
+        i_prog_sz,
+        o_matches,
+        i_matches_sz,
+        REX_VM_UNANCHORED | REX_VM_BYTES,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        o_match_found
+    );
+}
+
+
+/* 
+ * Same as rex_vm_search but positions i_literal can not be reached from
+ * are skipped. i_literal is the output of rex_prog_prefix or
+ * rex_prog_literal for i_prog
+ */
+int
+rex_vm_search_literal(
+    rex_vm_t * io_vm,
+    const rex_literal_t * const i_literal,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_match_t * o_matches,
+    size_t i_matches_sz,
+    int * o_match_found
+)
+{
+    if (!i_literal) return REX_BAD_PARAM;
+    return rex_vm_run(
+        io_vm,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        SIZE_MAX,
+        i_prog,
+        i_prog_sz,
+        o_matches,
+        i_matches_sz,
+        1,
+        i_literal,
+        NULL,
+        NULL,
+        NULL,
+        o_match_found
+    );
+}
+
+/* 
+ * Same as rex_vm_search but the search starts at the first candidate
+ * i_prefix is the output of rex_prog_prefix for i_prog
+ */
+int
+rex_vm_search_prefix(
+    rex_vm_t * io_vm,
+    const rex_prefix_t * const i_prefix,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_match_t * o_matches,
+    size_t i_matches_sz,
+    int * o_match_found
+)
+{
+    return rex_vm_search_literal(
+        io_vm,
+        i_prefix,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        i_prog,
+        i_prog_sz,
+        o_matches,
+        i_matches_sz,
+        o_match_found
+    );
+}
+
+
+/* 
+ * Same as rex_vm_exec and rex_vm_search, threads are added from i_closures,
+ * the output of rex_closures_compile for i_prog
+ * The VM runs even where rex_vm_exec would use the backtracker
+ */
+int
+rex_vm_exec_closures(
+    rex_vm_t * io_vm,
+    const rex_closures_t * const i_closures,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_match_t * o_matches,
+    size_t i_matches_sz,
+    int * o_match_found
+)
+{
+    if (!i_closures || i_closures->prog != i_prog || 
+        i_closures->prog_sz != i_prog_sz) return REX_BAD_PARAM;
+    return rex_vm_run(
+        io_vm,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        SIZE_MAX,
+        i_prog,
+        i_prog_sz,
+        o_matches,
+        i_matches_sz,
+        0,
+        NULL,
+        NULL,
+        i_closures,
+        NULL,
+        o_match_found
+    );
+}
+
+int
+rex_vm_search_closures(
+    rex_vm_t * io_vm,
+    const rex_closures_t * const i_closures,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_match_t * o_matches,
+    size_t i_matches_sz,
+    int * o_match_found
+)
+{
+    if (!i_closures || i_closures->prog != i_prog || 
+        i_closures->prog_sz != i_prog_sz) return REX_BAD_PARAM;
+    return rex_vm_run(
+        io_vm,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        SIZE_MAX,
+        i_prog,
+        i_prog_sz,
+        o_matches,
+        i_matches_sz,
+        1,
+        NULL,
+        NULL,
+        i_closures,
+        NULL,
+        o_match_found
+    );
+}
+
+/* 
+ * Decodes i_prog once for the runs of rex_vm_exec_ops and rex_vm_search_ops
+ * i_memory needs REX_VM_OPS_SZ(i_prog_sz) bytes, none without
+ * REX_THREADED_DISPATCH, and must outlive o_ops
+ * A program changed after it is decoded has to be decoded again
+ */
+int
+rex_vm_ops_compile(
+    rex_vm_ops_t * const o_ops,
+    void * const i_memory,
+    const size_t i_memory_sz,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz
+){
+#ifdef REX_VM_THREADED
+    rex_vm_t vm;
+#endif
+    if (!o_ops || !i_prog || (REX_VM_OPS_SZ(i_prog_sz) && !i_memory))
+        return REX_BAD_PARAM;
+    if (REX_VM_OPS_SZ(i_prog_sz) > i_memory_sz) return REX_OUT_OF_MEMORY;
+
+#ifdef REX_VM_THREADED
+    /* The handlers are only known to the thread run, which decodes
+     * without a thread to run */
+    REX_MEMSET(&vm, 0, sizeof(rex_vm_t));
+    vm.prog = i_prog;
+    vm.prog_sz = i_prog_sz;
+    vm.decode = rex_vm_ops_align(i_memory);
+    rex_vm_exec_thread(&vm);
+    o_ops->op = vm.ops;
+#endif
+    o_ops->prog = i_prog;
+    o_ops->prog_sz = i_prog_sz;
+    return REX_SUCESS;
+}
+
+/* 
+ * Same as rex_vm_exec and rex_vm_search, the program is run from i_ops,
+ * the output of rex_vm_ops_compile for i_prog
+ * The VM runs even where rex_vm_exec would use the backtracker
+ */
+int
+rex_vm_exec_ops(
+    rex_vm_t * io_vm,
+    const rex_vm_ops_t * const i_ops,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_match_t * o_matches,
+    size_t i_matches_sz,
+    int * o_match_found
+)
+{
+    if (!i_ops || i_ops->prog != i_prog || i_ops->prog_sz != i_prog_sz) 
+        return REX_BAD_PARAM;
+    return rex_vm_run(
+        io_vm,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        SIZE_MAX,
+        i_prog,
+        i_prog_sz,
+        o_matches,
+        i_matches_sz,
+        0,
+        NULL,
+        NULL,
+        NULL,
+        i_ops,
+        o_match_found
+    );
+}
+
+int
+rex_vm_search_ops(
+    rex_vm_t * io_vm,
+    const rex_vm_ops_t * const i_ops,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_match_t * o_matches,
+    size_t i_matches_sz,
+    int * o_match_found
+)
+{
+    if (!i_ops || i_ops->prog != i_prog || i_ops->prog_sz != i_prog_sz) 
+        return REX_BAD_PARAM;
+    return rex_vm_run(
+        io_vm,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        SIZE_MAX,
+        i_prog,
+        i_prog_sz,
+        o_matches,
+        i_matches_sz,
+        1,
+        NULL,
+        NULL,
+        NULL,
+        i_ops,
+        o_match_found
+    );
+}
+
+
+/* 
+ * Same as rex_vm_search, i_ac is the output of rex_aho_corasick_compile
+ * for i_prog. When the automaton is the whole matcher the VM only runs
+ * from the start of the match to fill submatches.
+ */
+int
+rex_aho_corasick_search(
+    rex_vm_t * io_vm,
+    const rex_aho_corasick_t * const i_ac,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_match_t * o_matches,
+    size_t i_matches_sz,
+    int * o_match_found
+)
+{
+    size_t start, end;
+    if (!i_ac || !i_string) return REX_BAD_PARAM;
+    if (!i_ac->whole) return rex_vm_run(
+        io_vm,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        SIZE_MAX,
+        i_prog,
+        i_prog_sz,
+        o_matches,
+        i_matches_sz,
+        1,
+        NULL,
+        i_ac,
+        NULL,
+        NULL,
+        o_match_found
+    );
+
+    rex_aho_corasick_find(
+        i_ac,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        &start,
+        &end
+    );
+    if (start == SIZE_MAX || i_matches_sz <= 1)
+    {
+        if (o_matches)
+            REX_MEMSET(o_matches, 0, sizeof(rex_match_t) * i_matches_sz);
+        if (o_matches && i_matches_sz && start != SIZE_MAX)
+            o_matches[0] = (rex_match_t){i_string + start, end - start};
+        if (o_match_found) *o_match_found = start != SIZE_MAX;
+        return REX_SUCESS;
+    }
+    return rex_vm_run(
+        io_vm,
+        i_string,
+        i_string_sz,
+        start,
+        end,
+        i_prog,
+        i_prog_sz,
+        o_matches,
+        i_matches_sz,
+        0,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        o_match_found
+    );
+}
+
+/* 
+ * Adds the pcs reachable from i_pc at i_pos without consuming a codepoint
+ * Assertions are checked at i_pos as the whole string is known
+ */
+static int
+rex_vm_reverse_closure(
+    const char * const i_string,
+    const size_t i_string_sz,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_vm_threadlist_t * const io_list,
+    uint32_t * const io_stack,
+    uint32_t i_pc,
+    const size_t i_pos
+){
+    uint32_t * const pcs = io_list->buffer;
+    const uint8_t at_end = i_pos >= i_string_sz || i_string[i_pos] == 0;
+    /* Can look back one byte as any valid unicode byte will return false */
+    const uint8_t boundary = 
+        (i_pos == 0 ? 0 : REX_ISWORD(i_string[i_pos - 1])) != 
+        (at_end ? 0 : REX_ISWORD(i_string[i_pos]));
+    size_t sp = 0;
+    uint32_t inst, imm;
+
+    for (;;)
+    {
+        if (i_pc >= i_prog_sz) return REX_BAD_INSTRUCTION;
+        if (!rex_vm_threadlist_visit(io_list, i_pc)) goto closure_pop;
+        inst = i_prog[i_pc];
+        imm = REX_IMM_FROM_INST(inst);
+        switch (REX_OP_FROM_INST(inst))
+        {
+        case REX_OPCODE_J:
+            i_pc = imm;
+            continue;
+        case REX_OPCODE_B:
+        case REX_OPCODE_BWP:
+            io_stack[sp++] = imm;
+            i_pc++;
+            continue;
+        case REX_OPCODE_SS:
+            i_pc++;
+            continue;
+        case REX_OPCODE_AS:
+            if (i_pos != 0) goto closure_pop;
+            i_pc++;
+            continue;
+        case REX_OPCODE_AE:
+            if (!at_end) goto closure_pop;
+            i_pc++;
+            continue;
+        case REX_OPCODE_AWB:
+            if (!boundary) goto closure_pop;
+            i_pc++;
+            continue;
+        case REX_OPCODE_ANWB:
+            if (boundary) goto closure_pop;
+            i_pc++;
+            continue;
+        default:
+            break;
+        }
+        pcs[io_list->thread_count++] = i_pc;
+
+    closure_pop:
+        if (sp == 0) return REX_SUCESS;
+        i_pc = io_stack[--sp];
+    }
+}
+
+/* 
+ * Runs a program from rex_ast_compile_reverse backward from i_string_end
+ * o_match_start receives the smallest position, not before i_string_start,
+ * at which the program matches. Thread priority does not matter here so
+ * only the set of pcs is kept.
+ *
+ * Uses the memory of io_vm, rex_vm_memory_sz(i_prog_sz, 0) is enough
+ */
+int
+rex_vm_reverse(
+    rex_vm_t * io_vm,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const size_t i_string_end,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    size_t * o_match_start,
+    int * o_match_found
+){
+    rex_vm_threadlist_t clist, nlist, tmp;
+    uint32_t * stack, * pcs;
+    uint32_t cp, next;
+    size_t pos, l, i;
+    int found = 0;
+    int r;
+
+    if (!io_vm || !i_string || !i_prog ) return REX_BAD_PARAM;
+    if (rex_vm_memory_sz(i_prog_sz, 0) > io_vm->memory_sz)
+        return REX_OUT_OF_MEMORY;
+
+    /* Same footprint as the VM without markers */
+    clist.buffer = io_vm->memory;
+    clist.sparse = ((uint32_t *)clist.buffer) + i_prog_sz;
+    clist.dense = clist.sparse + i_prog_sz;
+    nlist.buffer = clist.dense + i_prog_sz;
+    nlist.sparse = ((uint32_t *)nlist.buffer) + i_prog_sz;
+    nlist.dense = nlist.sparse + i_prog_sz;
+    stack = nlist.dense + i_prog_sz;
+    clist.marker_count = nlist.marker_count = 0;
+    REX_MEMSET(clist.sparse, 0, sizeof(uint32_t) * i_prog_sz);
+    REX_MEMSET(nlist.sparse, 0, sizeof(uint32_t) * i_prog_sz);
+    rex_vm_threadlist_clear(&clist);
+    rex_vm_threadlist_clear(&nlist);
+
+    pos = i_string_end;
+    r = rex_vm_reverse_closure(
+        i_string, i_string_sz, i_prog, i_prog_sz, &clist, stack, 0, pos
+    );
+    if (r) return r;
+
+    while (clist.thread_count)
+    {
+        pcs = clist.buffer;
+        for (i = 0; i < clist.thread_count; i++)
+            if (REX_OP_FROM_INST(i_prog[pcs[i]]) == REX_OPCODE_M)
+            {
+                found = 1;
+                if (o_match_start) *o_match_start = pos;
+                break;
+            }
+
+        l = rex_parse_utf8_codepoint_reverse(
+            i_string,
+            pos,
+            i_string_start,
+            &cp
+        );
+        if (l == 0) break;
+        for (i = 0; i < clist.thread_count; i++)
+        {
+            if (REX_OP_FROM_INST(i_prog[pcs[i]]) == REX_OPCODE_M) continue;
+            r = rex_prog_chain_step(i_prog, i_prog_sz, pcs[i], cp, &next);
+            if (r) return r;
+            if (next == REX_PC_HALTED) continue;
+            r = rex_vm_reverse_closure(
+                i_string, i_string_sz, i_prog, i_prog_sz, &nlist, stack, 
+                next, pos - l
+            );
+            if (r) return r;
+        }
+        tmp = clist;
+        clist = nlist;
+        nlist = tmp;
+        rex_vm_threadlist_clear(&nlist);
+        pos -= l;
+    }
+    if (o_match_found) *o_match_found = found;
+    return REX_SUCESS;
+}
+
+/* REX STREAMS */
+
+/*
+ * A stream runs the VM over input that arrives in chunks, with the same
+ * result as rex_vm_exec or rex_vm_search over the chunks put together.
+ *
+ * The VM only steps at a position once the codepoint after it is complete,
+ * as the assertions look ahead one byte and the next codepoint is decoded
+ * at the end of the step. The bytes from that position on are kept in the
+ * window and run with the start of the next chunk, the chunk itself is
+ * only read while it is fed. Positions are absolute so the markers of a
+ * thread stay valid across chunks.
+ */
+typedef struct rex_vm_stream_s rex_vm_stream_t;
+
+/* Bytes that must follow the codepoint at a position before it is run */
+#define REX_VM_STREAM_AHEAD (REX_UTF8_MULTIBYTE_MAX)
+
+/* Kept bytes, a codepoint and what follows it, and the head of a chunk */
+#define REX_VM_STREAM_WINDOW_SZ (REX_VM_STREAM_AHEAD * 4)
+
+struct rex_vm_stream_s
+{
+    rex_vm_t vm;
+    void * memory;
+    size_t memory_sz;
+    const rex_instruction_t * prog;
+    size_t prog_sz;
+    rex_stream_match_t * matches;
+    size_t matches_sz;
+    int flags;
+    char window[REX_VM_STREAM_WINDOW_SZ];
+    /* Bytes at the start of window the VM has not run past */
+    size_t window_sz;
+    int started;
+    int ended;
+};
+
+/* 
+ * Steps io_stream until the VM halts or reaches a position at or after
+ * i_stop or one too close to the end of the string to be run yet
+ */
+static int
+rex_vm_stream_run(
+    rex_vm_stream_t * const io_stream,
+    const size_t i_stop
+){
+    rex_vm_t * const vm = &io_stream->vm;
+    /* A position whose next codepoint starts past this is not run yet */
+    const size_t ahead_end = io_stream->ended ? SIZE_MAX :
+        vm->string_sz < REX_VM_STREAM_AHEAD ? 0 : 
+        vm->string_sz - REX_VM_STREAM_AHEAD;
+    const size_t stop = io_stream->ended ? SIZE_MAX : i_stop;
+    int r;
+    while (!vm->halted)
+    {
+        /* ti is 0 only before the first thread of a position */
+        if (vm->ti == 0 && (vm->cpi >= stop || vm->cpi + vm->l > ahead_end))
+            return REX_SUCESS;
+        r = rex_vm_exec_step(vm);
+        if (r) return r;
+    }
+    return REX_SUCESS;
+}
+
+/* Moves the VM to i_string, which starts i_delta bytes past its string */
+static inline void
+rex_vm_stream_move(
+    rex_vm_t * const io_vm,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_delta
+){
+    io_vm->string = i_string;
+    io_vm->string_sz = i_string_sz;
+    io_vm->string_offset += i_delta;
+    io_vm->cpi -= i_delta;
+    io_vm->ascii_end = 0;
+    io_vm->ascii_checked = 0;
+}
+
+/* Keeps the bytes the VM has not run past in the window */
+static inline void
+rex_vm_stream_keep(
+    rex_vm_stream_t * const io_stream
+){
+    rex_vm_t * const vm = &io_stream->vm;
+    io_stream->window_sz = vm->string_sz - vm->cpi;
+    REX_MEMMOVE(io_stream->window, vm->string + vm->cpi, io_stream->window_sz);
+    rex_vm_stream_move(vm, io_stream->window, io_stream->window_sz, vm->cpi);
+}
+
+/* Starts the VM on the window */
+static int
+rex_vm_stream_start(
+    rex_vm_stream_t * const io_stream
+){
+    int r = rex_vm_exec_init(
+        &io_stream->vm,
+        io_stream->memory,
+        io_stream->memory_sz,
+        io_stream->window,
+        io_stream->window_sz,
+        0,
+        SIZE_MAX,
+        io_stream->prog,
+        io_stream->prog_sz,
+        NULL,
+        io_stream->matches_sz,
+        io_stream->flags,
+        NULL,
+        NULL
+    );
+    if (r) return r;
+    io_stream->vm.stream_matches = io_stream->matches;
+    io_stream->started = 1;
+    return REX_SUCESS;
+}
+
+/* 
+ * Begins a stream of i_prog
+ *
+ * Arguments:
+ *      i_memory:    VM memory, at least rex_vm_memory_sz(i_prog_sz, 
+ *                   i_matches_sz), kept until rex_vm_stream_end
+ *      o_matches:   written by rex_vm_stream_end, offsets are from the 
+ *                   start of the stream
+ *      i_flags:     REX_VM_UNANCHORED searches, REX_VM_BYTES runs a 
+ *                   program from rex_prog_bytes
+ */
+int
+rex_vm_stream_begin(
+    rex_vm_stream_t * o_stream,
+    void * i_memory,
+    const size_t i_memory_sz,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_stream_match_t * o_matches,
+    const size_t i_matches_sz,
+    const int i_flags
+){
+    size_t i;
+    if (!o_stream || !i_memory || !i_prog || (i_matches_sz && !o_matches))
+        return REX_BAD_PARAM;
+    if (rex_vm_memory_sz(i_prog_sz, i_matches_sz) > i_memory_sz)
+        return REX_OUT_OF_MEMORY;
+    REX_MEMSET(o_stream, 0, sizeof(rex_vm_stream_t));
+    o_stream->memory = i_memory;
+    o_stream->memory_sz = i_memory_sz;
+    o_stream->prog = i_prog;
+    o_stream->prog_sz = i_prog_sz;
+    o_stream->matches = o_matches;
+    o_stream->matches_sz = i_matches_sz;
+    o_stream->flags = i_flags;
+    for (i = 0; i < i_matches_sz; i++)
+        o_matches[i] = (rex_stream_match_t){SIZE_MAX, 0};
+    return REX_SUCESS;
+}
+
+/* 
+ * Runs the next i_chunk_sz bytes of the stream
+ * Once the VM halts the rest of the stream is not looked at
+ */
+int
+rex_vm_stream_feed(
+    rex_vm_stream_t * io_stream,
+    const char * const i_chunk,
+    const size_t i_chunk_sz
+){
+    rex_vm_t * vm;
+    size_t kept, n;
+    int r;
+    if (!io_stream || (!i_chunk && i_chunk_sz)) return REX_BAD_PARAM;
+    if (io_stream->ended) return REX_BAD_PARAM;
+    vm = &io_stream->vm;
+    kept = io_stream->window_sz;
+    if (vm->halted || i_chunk_sz == 0) return REX_SUCESS;
+
+    /* Run the kept bytes with the head of the chunk */
+    n = REX_VM_STREAM_WINDOW_SZ - kept;
+    if (n > i_chunk_sz) n = i_chunk_sz;
+    REX_MEMCPY(io_stream->window + kept, i_chunk, n);
+    io_stream->window_sz += n;
+    if (!io_stream->started)
+    {
+        if (io_stream->window_sz < REX_VM_STREAM_AHEAD) return REX_SUCESS;
+        r = rex_vm_stream_start(io_stream);
+    }else{
+        vm->string_sz = io_stream->window_sz;
+        r = REX_SUCESS;
+    }
+    if (r) return r;
+    r = rex_vm_stream_run(io_stream, kept);
+    if (r || vm->halted) return r;
+    /* The window holds the whole chunk when the VM stops short of it */
+    if (vm->cpi < kept)
+    {
+        rex_vm_stream_keep(io_stream);
+        return REX_SUCESS;
+    }
+
+    rex_vm_stream_move(vm, i_chunk, i_chunk_sz, kept);
+    r = rex_vm_stream_run(io_stream, SIZE_MAX);
+    if (r || vm->halted) return r;
+    rex_vm_stream_keep(io_stream);
+    return REX_SUCESS;
+}
+
+/* 
+ * Ends the stream, running what is left of it
+ * o_match_found is set if a match was found, which is in o_matches
+ */
+int
+rex_vm_stream_end(
+    rex_vm_stream_t * io_stream,
+    int * o_match_found
+){
+    int r;
+    if (!io_stream || io_stream->ended) return REX_BAD_PARAM;
+    io_stream->ended = 1;
+    if (!io_stream->started)
+    {
+        r = rex_vm_stream_start(io_stream);
+        if (r) return r;
+    }
+    r = rex_vm_stream_run(io_stream, SIZE_MAX);
+    if (r) return r;
+    if (o_match_found) *o_match_found = io_stream->vm.match;
+    return REX_SUCESS;
+}
+
+/* REX FIND ALL */
+
+/*
+ * A find iterator returns the successive non-overlapping matches of a
+ * program in a string, as rex_vm_search would find them one at a time.
+ *
+ * The VM is initialised once. After a match it halts with its lists empty,
+ * so the next search restarts the same VM at the end of the match instead.
+ * An empty match is never returned where the previous match ended, the
+ * search moves one codepoint on instead, so every call makes progress.
+ */
+typedef struct rex_vm_find_iter_s rex_vm_find_iter_t;
+
+struct rex_vm_find_iter_s
+{
+    rex_vm_t vm;
+    /* End of the last match returned and if there was one */
+    size_t last_end;
+    int found;
+    int done;
+};
+
+/* 
+ * Begins iterating over the matches of i_prog in i_string from 
+ * i_string_start, arguments are the same as rex_vm_search
+ * i_matches_sz must be at least 1, o_matches is written by every match
+ * i_flags is REX_VM_BYTES for a program from rex_prog_bytes or 0, the
+ * search is always unanchored
+ */
+int
+rex_vm_find_iter_begin(
+    rex_vm_find_iter_t * o_iter,
+    void * i_memory,
+    const size_t i_memory_sz,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    rex_match_t * o_matches,
+    const size_t i_matches_sz,
+    const int i_flags
+){
+    if (!o_iter || !o_matches || i_matches_sz == 0) return REX_BAD_PARAM;
+    o_iter->last_end = 0;
+    o_iter->found = 0;
+    o_iter->done = 0;
+    return rex_vm_exec_init(
+        &o_iter->vm,
+        i_memory,
+        i_memory_sz,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        SIZE_MAX,
+        i_prog,
+        i_prog_sz,
+        o_matches,
+        i_matches_sz,
+        REX_VM_UNANCHORED | (i_flags & REX_VM_BYTES),
+        NULL,
+        NULL
+    );
+}
+
+/* Restarts the halted search of io_iter past its last match */
+static int
+rex_vm_find_iter_restart(
+    rex_vm_find_iter_t * const io_iter,
+    const int i_skip
+){
+    rex_vm_t * const vm = &io_iter->vm;
+    size_t pos = io_iter->last_end;
+    uint32_t cp = 0;
+    size_t l;
+    if (i_skip)
+    {
+        /* Step over the codepoint after an empty match */
+        if (vm->bytes)
+        {
+            l = pos < vm->string_sz;
+            if (l) cp = (uint8_t) vm->string[pos];
+            while (
+                cp && pos + l < vm->string_sz &&
+                REX_UTF8_IS_TAIL((uint8_t) vm->string[pos + l])
+            ) l++;
+        }else{
+            l = rex_parse_utf8_codepoint(
+                vm->string + pos, 
+                vm->string_sz - pos, 
+                &cp
+            );
+        }
+        if (l == 0 || cp == 0)
+        {
+            io_iter->done = 1;
+            return REX_SUCESS;
+        }
+        pos += l;
+    }
+    vm->match = 0;
+    vm->halted = 0;
+    /* The ASCII run found ahead may start after pos */
+    vm->ascii_end = 0;
+    vm->ascii_checked = 0;
+    return rex_vm_exec_skip(vm, pos);
+}
+
+/* 
+ * Finds the next match of io_iter
+ * o_match_found is set to 0 once there are no more
+ */
+int
+rex_vm_find_iter_next(
+    rex_vm_find_iter_t * io_iter,
+    int * o_match_found
+){
+    rex_vm_t * vm;
+    size_t start, end;
+    int r;
+    if (!io_iter || !o_match_found) return REX_BAD_PARAM;
+    vm = &io_iter->vm;
+    *o_match_found = 0;
+    if (io_iter->done) return REX_SUCESS;
+    if (io_iter->found)
+    {
+        r = rex_vm_find_iter_restart(
+            io_iter, 
+            vm->matches[0].match_sz == 0
+        );
+        if (r || io_iter->done) return r;
+    }
+
+    for (;;)
+    {
+        while (!vm->halted)
+        {
+            r = rex_vm_exec_step(vm);
+            if (r) return r;
+        }
+        if (!vm->match)
+        {
+            io_iter->done = 1;
+            return REX_SUCESS;
+        }
+        start = vm->matches[0].match - vm->string;
+        end = start + vm->matches[0].match_sz;
+        if (start != end || !io_iter->found || end != io_iter->last_end) 
+            break;
+        /* Empty where the last match ended */
+        r = rex_vm_find_iter_restart(io_iter, 1);
+        if (r || io_iter->done) return r;
+    }
+    io_iter->last_end = end;
+    io_iter->found = 1;
+    *o_match_found = 1;
+    return REX_SUCESS;
+}
+
+/* REX LAZY DFA */
+
+/*
+ * The DFA answers if and where a program matches, without submatches.
+ *
+ * A DFA state is the priority ordered list of threads the VM would hold at a
+ * position. States are built the first time a transition out of them is taken
+ * and kept in a cache in the DFA memory, so on a warm cache an ASCII byte costs
+ * one table lookup. When the cache is full it is cleared and rebuilt.
+ *
+ * AE, AWB and ANWB depend on the codepoint that follows a position.
+ * They are left unresolved in a state and resolved when the next transition
+ * is built. Transitions remember if the state they leave matched.
+ *
+ * Unanchored searches mark a state with the pc prog_sz while the implicit
+ * restart thread is alive. It is always the lowest priority thread.
+ */
+typedef struct rex_dfa_s rex_dfa_t;
+
+struct rex_dfa_s
+{
+    void * memory;
+    size_t memory_sz;
+    const rex_instruction_t * prog;
+    size_t prog_sz;
+    uint32_t * bounds;
+    size_t class_count;
+    uint32_t * ascii_class;
+    rex_vm_threadlist_t rlist, nlist;
+    uint32_t * stack;
+    uint32_t * buckets;
+    size_t bucket_count;
+    uint32_t * arena;
+    size_t arena_sz;
+    size_t arena_top;
+    size_t state_count;
+    size_t cache_clears;
+    uint32_t starts[8];
+    uint8_t word_asserts;
+    /* The program is a byte program and ascii_class covers every byte */
+    uint8_t bytes;
+};
+
+/* State Memory Layout
+ *
+ * uint32_t : flags
+ * uint32_t : thread count
+ * uint32_t[class_count] : transitions
+ * uint32_t : transition taken at the end of the string
+ * uint32_t[thread count] : pcs
+ *
+ * States are referred to by their offset into the arena
+ */
+#define REX_DFA_STATE_TRANSITIONS(state) ((state) + 2)
+#define REX_DFA_STATE_PCS(dfa, state) ((state) + 3 + (dfa)->class_count)
+
+#define REX_DFA_FLAG_PREV_WORD  (1)
+#define REX_DFA_FLAG_START      (2)
+
+/* Transition values */
+#define REX_DFA_MATCH           (0x80000000)
+#define REX_DFA_UNKNOWN         (0x7FFFFFFF)
+#define REX_DFA_DEAD            (0x7FFFFFFE)
+#define REX_DFA_EMPTY_BUCKET    (0xFFFFFFFF)
+
+/* Closure contexts */
+#define REX_DFA_CTX_START       (1)
+#define REX_DFA_CTX_RESOLVE     (2)
+#define REX_DFA_CTX_END         (4)
+#define REX_DFA_CTX_PREV_WORD   (8)
+#define REX_DFA_CTX_NEXT_WORD   (16)
+
+static inline void
+rex_dfa_cache_clear(
+    rex_dfa_t * const io_dfa
+){
+    REX_MEMSET(
+        io_dfa->buckets,
+        0xFF,
+        sizeof(uint32_t) * io_dfa->bucket_count
+    );
+    REX_MEMSET(io_dfa->starts, 0xFF, sizeof(io_dfa->starts));
+    io_dfa->arena_top = 0;
+    io_dfa->state_count = 0;
+    io_dfa->cache_clears++;
+}
+
+/* 
+ * i_bytes builds the DFA of a byte program, see rex_dfa_init_bytes
+ * Programs testing sets of a constant pool are REX_UNSUPPORTED_PROGRAM
+ *
+ * Memory Layout
+ *
+ * uint32_t[REX_PROG_CLASSES_MAX(prog_sz)] : class bounds
+ * uint32_t[128] : class of every ascii codepoint, 256 bytes with i_bytes
+ * uint32_t[prog_sz * 3] : rlist pcs, sparse and dense
+ * uint32_t[prog_sz * 3 + 1] : nlist pcs, sparse and dense
+ * uint32_t[prog_sz] : closure stack
+ * uint32_t[] : state cache buckets, a power of two
+ * uint32_t[] : state cache arena
+ */
+static int
+rex_dfa_init_mode(
+    rex_dfa_t * const o_dfa,
+    void * const i_memory,
+    const size_t i_memory_sz,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz,
+    const uint8_t i_bytes
+){
+    const size_t direct = i_bytes ? 256 : 128;
+    uint32_t * mem = i_memory;
+    size_t words, fixed, i;
+
+    if (!o_dfa || !i_memory || !i_prog) return REX_BAD_PARAM;
+
+    words = i_memory_sz / sizeof(uint32_t);
+    fixed = REX_PROG_CLASSES_MAX(i_prog_sz) + direct + i_prog_sz * 7 + 1;
+    if (fixed + 16 > words) return REX_OUT_OF_MEMORY;
+
+    REX_MEMSET(o_dfa, 0, sizeof(rex_dfa_t));
+    o_dfa->memory = i_memory;
+    o_dfa->memory_sz = i_memory_sz;
+    o_dfa->prog = i_prog;
+    o_dfa->prog_sz = i_prog_sz;
+    o_dfa->bytes = i_bytes;
+
+    o_dfa->bounds = mem;
+    o_dfa->class_count = rex_prog_classes(
+        i_prog,
+        i_prog_sz,
+        i_bytes,
+        o_dfa->bounds
+    );
+    if (o_dfa->class_count == 0) return REX_UNSUPPORTED_PROGRAM;
+    mem += REX_PROG_CLASSES_MAX(i_prog_sz);
+
+    o_dfa->ascii_class = mem;
+    for (i = 0; i < direct; i++)
+        o_dfa->ascii_class[i] = 
+            rex_class_of(o_dfa->bounds, o_dfa->class_count, i);
+    mem += direct;
+
+    o_dfa->rlist.buffer = mem;
+    o_dfa->rlist.sparse = mem + i_prog_sz;
+    o_dfa->rlist.dense = mem + i_prog_sz * 2;
+    mem += i_prog_sz * 3;
+    o_dfa->nlist.buffer = mem;
+    o_dfa->nlist.sparse = mem + i_prog_sz + 1;
+    o_dfa->nlist.dense = mem + i_prog_sz * 2 + 1;
+    mem += i_prog_sz * 3 + 1;
+    REX_MEMSET(o_dfa->rlist.sparse, 0, sizeof(uint32_t) * i_prog_sz);
+    REX_MEMSET(o_dfa->nlist.sparse, 0, sizeof(uint32_t) * i_prog_sz);
+    o_dfa->stack = mem;
+    mem += i_prog_sz;
+
+    words -= fixed;
+    for (o_dfa->bucket_count = 8; o_dfa->bucket_count * 32 <= words;)
+        o_dfa->bucket_count *= 2;
+    o_dfa->buckets = mem;
+    o_dfa->arena = mem + o_dfa->bucket_count;
+    o_dfa->arena_sz = REX_MIN(words - o_dfa->bucket_count, REX_DFA_DEAD);
+
+    for (i = 0; i < i_prog_sz; i++)
+    {
+        switch (REX_OP_FROM_INST(i_prog[i]))
+        {
+        case REX_OPCODE_AWB:
+        case REX_OPCODE_ANWB:
+            o_dfa->word_asserts = 1;
+            break;
+        default:
+            break;
+        }
+    }
+
+    rex_dfa_cache_clear(o_dfa);
+    o_dfa->cache_clears = 0;
+    return REX_SUCESS;
+}
+
+int
+rex_dfa_init(
+    rex_dfa_t * const o_dfa,
+    void * const i_memory,
+    const size_t i_memory_sz,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz
+){
+    return rex_dfa_init_mode(
+        o_dfa,
+        i_memory,
+        i_memory_sz,
+        i_prog,
+        i_prog_sz,
+        0
+    );
+}
+
+/* 
+ * Builds the DFA of a byte program from rex_prog_bytes
+ * Every byte is a column of the class table, so the DFA never decodes
+ */
+int
+rex_dfa_init_bytes(
+    rex_dfa_t * const o_dfa,
+    void * const i_memory,
+    const size_t i_memory_sz,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz
+){
+    return rex_dfa_init_mode(
+        o_dfa,
+        i_memory,
+        i_memory_sz,
+        i_prog,
+        i_prog_sz,
+        1
+    );
+}
+
+/* 
+ * Appends the threads reachable from i_pc without consuming a codepoint
+ * to io_list in priority order
+ * Assertions that need the next codepoint are appended unresolved
+ * unless i_ctx contains REX_DFA_CTX_RESOLVE
+ */
+static int
+rex_dfa_closure(
+    rex_dfa_t * const io_dfa,
+    rex_vm_threadlist_t * const io_list,
+    uint32_t i_pc,
+    const unsigned i_ctx
+){
+    uint32_t * const stack = io_dfa->stack;
+    uint32_t * const pcs = io_list->buffer;
+    size_t sp = 0;
+    uint32_t inst, imm;
+    const uint8_t boundary = 
+        !(i_ctx & REX_DFA_CTX_PREV_WORD) != !(i_ctx & REX_DFA_CTX_NEXT_WORD);
+
+    for (;;)
+    {
+        if (i_pc >= io_dfa->prog_sz) return REX_BAD_INSTRUCTION;
+        if (!rex_vm_threadlist_visit(io_list, i_pc)) goto closure_pop;
+        inst = io_dfa->prog[i_pc];
+        imm = REX_IMM_FROM_INST(inst);
+        switch (REX_OP_FROM_INST(inst))
+        {
+        case REX_OPCODE_J:
+            i_pc = imm;
+            continue;
+        case REX_OPCODE_B:
+            stack[sp++] = imm;
+            i_pc++;
+            continue;
+        case REX_OPCODE_BWP:
+            stack[sp++] = i_pc + 1;
+            i_pc = imm;
+            continue;
+        case REX_OPCODE_SS:
+            i_pc++;
+            continue;
+        case REX_OPCODE_AS:
+            if (!(i_ctx & REX_DFA_CTX_START)) goto closure_pop;
+            i_pc++;
+            continue;
+        case REX_OPCODE_AE:
+            if (!(i_ctx & REX_DFA_CTX_RESOLVE)) break;
+            if (!(i_ctx & REX_DFA_CTX_END)) goto closure_pop;
+            i_pc++;
+            continue;
+        case REX_OPCODE_AWB:
+            if (!(i_ctx & REX_DFA_CTX_RESOLVE)) break;
+            if (!boundary) goto closure_pop;
+            i_pc++;
+            continue;
+        case REX_OPCODE_ANWB:
+            if (!(i_ctx & REX_DFA_CTX_RESOLVE)) break;
+            if (boundary) goto closure_pop;
+            i_pc++;
+            continue;
+        default:
+            break;
+        }
+        pcs[io_list->thread_count++] = i_pc;
+
+    closure_pop:
+        if (sp == 0) return REX_SUCESS;
+        i_pc = stack[--sp];
+    }
+}
+
+/* 
+ * Finds the state with i_flags and the pcs of i_list, adding it if needed
+ * The cache is cleared when it is full
+ */
+static int
+rex_dfa_state_find(
+    rex_dfa_t * const io_dfa,
+    const uint32_t i_flags,
+    const rex_vm_threadlist_t * const i_list,
+    uint32_t * const o_state
+){
+    const uint32_t * const pcs = i_list->buffer;
+    const size_t count = i_list->thread_count;
+    const size_t mask = io_dfa->bucket_count - 1;
+    const size_t state_sz = 3 + io_dfa->class_count + count;
+    uint32_t hash = 2166136261u;
+    uint32_t * state;
+    size_t i, b;
+
+    if (count == 0)
+    {
+        *o_state = REX_DFA_DEAD;
         return REX_SUCESS;
-    } 
-    io_vm->ti++;
+    }
+
+    /* FNV-1a */
+    hash = (hash ^ i_flags) * 16777619u;
+    for (i = 0; i < count; i++) hash = (hash ^ pcs[i]) * 16777619u;
+
+    for (b = hash & mask; io_dfa->buckets[b] != REX_DFA_EMPTY_BUCKET; b = (b + 1) & mask)
+    {
+        state = io_dfa->arena + io_dfa->buckets[b];
+        if (state[0] == i_flags && state[1] == count && 
+            !memcmp(REX_DFA_STATE_PCS(io_dfa, state), pcs, sizeof(uint32_t) * count)
+        ){
+            *o_state = io_dfa->buckets[b];
+            return REX_SUCESS;
+        }
+    }
+
+    if (
+        io_dfa->arena_top + state_sz > io_dfa->arena_sz ||
+        io_dfa->state_count + 1 > io_dfa->bucket_count / 2
+    ){
+        if (io_dfa->state_count == 0) return REX_OUT_OF_MEMORY;
+        rex_dfa_cache_clear(io_dfa);
+        return rex_dfa_state_find(io_dfa, i_flags, i_list, o_state);
+    }
+
+    state = io_dfa->arena + io_dfa->arena_top;
+    state[0] = i_flags;
+    state[1] = count;
+    for (i = 0; i <= io_dfa->class_count; i++)
+        REX_DFA_STATE_TRANSITIONS(state)[i] = REX_DFA_UNKNOWN;
+    REX_MEMCPY(REX_DFA_STATE_PCS(io_dfa, state), pcs, sizeof(uint32_t) * count);
+
+    io_dfa->buckets[b] = io_dfa->arena_top;
+    *o_state = io_dfa->arena_top;
+    io_dfa->arena_top += state_sz;
+    io_dfa->state_count++;
+    return REX_SUCESS;
+}
+
+/* 
+ * Builds the transition out of i_state for i_class
+ * i_class == class_count is the end of the string
+ */
+static int
+rex_dfa_transition(
+    rex_dfa_t * const io_dfa,
+    const uint32_t i_state,
+    const size_t i_class,
+    uint32_t * const o_next
+){
+    uint32_t * const state = io_dfa->arena + i_state;
+    const uint32_t * const state_pcs = REX_DFA_STATE_PCS(io_dfa, state);
+    const uint32_t * const rpcs = io_dfa->rlist.buffer;
+    const uint8_t end = i_class == io_dfa->class_count;
+    const uint32_t cp = end ? 0 : io_dfa->bounds[i_class];
+    /* Other programs restart after every codepoint, a byte program before
+     * every byte that starts one */
+    const uint8_t restart_here = io_dfa->bytes && !REX_UTF8_IS_TAIL(cp);
+    const size_t clears = io_dfa->cache_clears;
+    uint32_t next, pc;
+    uint8_t restart = 0;
+    uint8_t match = 0;
+    unsigned ctx;
+    size_t i;
+    int r;
+
+    ctx = REX_DFA_CTX_RESOLVE;
+    if (state[0] & REX_DFA_FLAG_START) ctx |= REX_DFA_CTX_START;
+    if (state[0] & REX_DFA_FLAG_PREV_WORD) ctx |= REX_DFA_CTX_PREV_WORD;
+    if (end) ctx |= REX_DFA_CTX_END;
+    else if (REX_ISWORD(cp)) ctx |= REX_DFA_CTX_NEXT_WORD;
+
+    rex_vm_threadlist_clear(&io_dfa->rlist);
+    rex_vm_threadlist_clear(&io_dfa->nlist);
+
+    for (i = 0; i < state[1]; i++)
+    {
+        if (state_pcs[i] == io_dfa->prog_sz)
+        {
+            restart = 1;
+            if (!restart_here) break;
+            r = rex_dfa_closure(io_dfa, &io_dfa->rlist, 0, ctx);
+            if (r) return r;
+            break;
+        }
+        r = rex_dfa_closure(io_dfa, &io_dfa->rlist, state_pcs[i], ctx);
+        if (r) return r;
+    }
+
+    for (i = 0; i < io_dfa->rlist.thread_count; i++)
+    {
+        pc = rpcs[i];
+        if (REX_OP_FROM_INST(io_dfa->prog[pc]) == REX_OPCODE_M)
+        {
+            /* Lower priority threads are cut */
+            match = 1;
+            restart = 0;
+            break;
+        }
+        if (end) continue;
+        r = rex_prog_chain_step(io_dfa->prog, io_dfa->prog_sz, pc, cp, &next);
+        if (r) return r;
+        if (next == REX_PC_HALTED) continue;
+        r = rex_dfa_closure(io_dfa, &io_dfa->nlist, next, 0);
+        if (r) return r;
+    }
+
+    if (end)
+    {
+        next = REX_DFA_DEAD | (match ? REX_DFA_MATCH : 0);
+        REX_DFA_STATE_TRANSITIONS(state)[i_class] = next;
+        *o_next = next;
+        return REX_SUCESS;
+    }
+
+    if (restart)
+    {
+        if (!io_dfa->bytes)
+        {
+            r = rex_dfa_closure(io_dfa, &io_dfa->nlist, 0, 0);
+            if (r) return r;
+        }
+        ((uint32_t *)io_dfa->nlist.buffer)[io_dfa->nlist.thread_count++] = 
+            io_dfa->prog_sz;
+    }
+
+    r = rex_dfa_state_find(
+        io_dfa,
+        io_dfa->word_asserts && REX_ISWORD(cp) ? REX_DFA_FLAG_PREV_WORD : 0,
+        &io_dfa->nlist,
+        &next
+    );
+    if (r) return r;
+    next |= match ? REX_DFA_MATCH : 0;
+
+    /* i_state is gone if the cache was cleared */
+    if (clears == io_dfa->cache_clears)
+        REX_DFA_STATE_TRANSITIONS(io_dfa->arena + i_state)[i_class] = next;
+    *o_next = next;
     return REX_SUCESS;
 }
 
+static int
+rex_dfa_start(
+    rex_dfa_t * const io_dfa,
+    const uint8_t i_at_start,
+    const uint8_t i_prev_word,
+    const uint8_t i_unanchored,
+    uint32_t * const o_state
+){
+    const size_t key = (i_unanchored << 2) | (i_at_start << 1) | i_prev_word;
+    int r;
+
+    if (io_dfa->starts[key] != REX_DFA_EMPTY_BUCKET)
+    {
+        *o_state = io_dfa->starts[key];
+        return REX_SUCESS;
+    }
+
+    rex_vm_threadlist_clear(&io_dfa->nlist);
+    r = rex_dfa_closure(
+        io_dfa, 
+        &io_dfa->nlist,
+        0,
+        i_at_start ? REX_DFA_CTX_START : 0
+    );
+    if (r) return r;
+    if (i_unanchored)
+        ((uint32_t *)io_dfa->nlist.buffer)[io_dfa->nlist.thread_count++] = 
+            io_dfa->prog_sz;
+
+    /* Unresolved assertions can be followed by AS */
+    r = rex_dfa_state_find(
+        io_dfa,
+        (io_dfa->word_asserts && i_prev_word ? REX_DFA_FLAG_PREV_WORD : 0) |
+        (i_at_start ? REX_DFA_FLAG_START : 0),
+        &io_dfa->nlist,
+        o_state
+    );
+    if (r) return r;
+    io_dfa->starts[key] = *o_state;
+    return REX_SUCESS;
+}
 
+/* Returns the end of the last match the VM would report */
 static int
-rex_vm_exec_step(
-    rex_vm_t * io_vm
+rex_dfa_scan(
+    rex_dfa_t * const io_dfa,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    const uint8_t i_unanchored,
+    size_t * const o_match_end,
+    int * const o_match_found
 ){
-    rex_vm_threadlist_t tmp;
-    if(io_vm->ti < io_vm->clist.thread_count)
+    const uint8_t * const str = (const uint8_t *) i_string;
+    uint32_t state, next, cp;
+    size_t pos, cls, l;
+    int r;
+
+    *o_match_found = 0;
+    /* Can look back one byte as any valid unicode byte will return false */
+    r = rex_dfa_start(
+        io_dfa,
+        i_string_start == 0,
+        i_string_start == 0 ? 0 : REX_ISWORD(i_string[i_string_start - 1]),
+        i_unanchored,
+        &state
+    );
+    if (r) return r;
+    if (state == REX_DFA_DEAD) return REX_SUCESS;
+
+    for (pos = i_string_start;;)
     {
-        return rex_vm_exec_thread(io_vm);
+        if (pos >= i_string_sz || str[pos] == 0)
+        {
+            cls = io_dfa->class_count;
+            l = 0;
+        }else if (!REX_UTF8_IS_MULTIBYTE(str[pos]) || io_dfa->bytes) {
+            cls = io_dfa->ascii_class[str[pos]];
+            l = 1;
+        }else{
+            l = rex_parse_utf8_codepoint(i_string + pos, i_string_sz - pos, &cp);
+            if (l == 0) break;
+            cls = rex_class_of(io_dfa->bounds, io_dfa->class_count, cp);
+        }
+
+        next = REX_DFA_STATE_TRANSITIONS(io_dfa->arena + state)[cls];
+        if (next == REX_DFA_UNKNOWN)
+        {
+            r = rex_dfa_transition(io_dfa, state, cls, &next);
+            if (r) return r;
+        }
+        if (next & REX_DFA_MATCH)
+        {
+            *o_match_found = 1;
+            *o_match_end = pos;
+        }
+        next &= ~REX_DFA_MATCH;
+        if (l == 0 || next == REX_DFA_DEAD) break;
+        state = next;
+        pos += l;
     }
-    
-    /* Swap clist and nlist */
-    tmp = io_vm->clist;
-    io_vm->clist = io_vm->nlist;
-    io_vm->nlist = tmp;
-    io_vm->nlist.thread_count = 0;
-    io_vm->prev_word = REX_ISWORD(io_vm->cp);
-    if (io_vm->cp == 0 || io_vm->l == 0)
+    return REX_SUCESS;
+}
+
+/* 
+ * Matches at i_string_start like rex_vm_exec
+ * o_match receives the bounds of the whole match (NULLABLE)
+ */
+int
+rex_dfa_exec(
+    rex_dfa_t * const io_dfa,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    rex_match_t * const o_match,
+    int * const o_match_found
+){
+    size_t end = 0;
+    int found, r;
+    if (!io_dfa || !i_string) return REX_BAD_PARAM;
+    r = rex_dfa_scan(
+        io_dfa,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        0,
+        &end,
+        &found
+    );
+    if (o_match)
+    {
+        o_match->match = found ? i_string + i_string_start : NULL;
+        o_match->match_sz = found ? end - i_string_start : 0;
+    }
+    if (o_match_found) *o_match_found = found;
+    return r;
+}
+
+/* 
+ * Searches like rex_vm_search
+ * Only the end of the match is known after a forward scan
+ */
+int
+rex_dfa_search(
+    rex_dfa_t * const io_dfa,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    size_t * const o_match_end,
+    int * const o_match_found
+){
+    size_t end = 0;
+    int found, r;
+    if (!io_dfa || !i_string) return REX_BAD_PARAM;
+    r = rex_dfa_scan(
+        io_dfa,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        1,
+        &end,
+        &found
+    );
+    if (o_match_end) *o_match_end = end;
+    if (o_match_found) *o_match_found = found;
+    return r;
+}
+
+/* REX TWO-PHASE MATCHING */
+
+/*
+ * Submatches are only needed for the span that matched. The lazy DFA first
+ * finds if there is a match and where it ends, then the VM is run to fill
+ * the submatches and stops at the end of the match instead of the string.
+ * When there is no match the VM is not run at all.
+ *
+ * With a reverse program the start of the match is found by running it
+ * backward from the end, the VM is then anchored at the start and is not
+ * run at all when only the whole match is asked for.
+ *
+ * Without one the VM still searches from i_string_start. A DFA state keeps
+ * one thread per pc whichever start it came from, so the state where a
+ * match begins can be the same as one where an earlier thread lives on, as
+ * in a*b over aaab, and the forward scan can not bound the start.
+ *
+ * io_vm and io_dfa are set up by the caller, the program is the one io_dfa
+ * was built with. If the DFA cache cannot hold a state the VM runs alone.
+ */
+static int
+rex_two_phase_run(
+    rex_vm_t * const io_vm,
+    rex_dfa_t * const io_dfa,
+    const rex_instruction_t * const i_reverse_prog,
+    const size_t i_reverse_prog_sz,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    rex_match_t * const o_matches,
+    const size_t i_matches_sz,
+    const int i_unanchored,
+    int * const o_match_found
+){
+    size_t start = i_string_start;
+    size_t end = SIZE_MAX;
+    int unanchored = i_unanchored;
+    int reverse = i_reverse_prog != NULL;
+    int found = 1;
+    int r;
+
+    if (!io_vm || !io_dfa || !i_string) return REX_BAD_PARAM;
+    r = rex_dfa_scan(
+        io_dfa,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        i_unanchored,
+        &end,
+        &found
+    );
+    if (r == REX_OUT_OF_MEMORY)
+    {
+        end = SIZE_MAX;
+        found = 1;
+    }else if (r) return r;
+
+    if (!found)
     {
-        io_vm->halted = 1;
+        if (o_matches) 
+            REX_MEMSET(o_matches, 0, sizeof(rex_match_t) * i_matches_sz);
+        if (o_match_found) *o_match_found = 0;
         return REX_SUCESS;
-    };
+    }
 
-    io_vm->cpi += io_vm->l;
+    /* found is cleared if the reverse program does not match, a byte
+     * program reversed would walk each encoding backwards so it has none */
+    if (io_dfa->bytes) reverse = 0;
+    if (reverse && unanchored && end != SIZE_MAX)
+    {
+        r = rex_vm_reverse(
+            io_vm,
+            i_string,
+            i_string_sz,
+            i_string_start,
+            end,
+            i_reverse_prog,
+            i_reverse_prog_sz,
+            &start,
+            &found
+        );
+        if (r) return r;
+    }
+    if (reverse && unanchored && found && end != SIZE_MAX)
+    {
+        unanchored = 0;
+        if (i_matches_sz <= 1)
+        {
+            if (i_matches_sz)
+                o_matches[0] = (rex_match_t){i_string + start, end - start};
+            if (o_match_found) *o_match_found = 1;
+            return REX_SUCESS;
+        }
+    }
 
-    io_vm->l = rex_parse_utf8_codepoint(
-        io_vm->string + io_vm->cpi,
-        io_vm->string_sz - io_vm->cpi,
-        &io_vm->cp
+    return rex_vm_run(
+        io_vm,
+        i_string,
+        i_string_sz,
+        start,
+        end,
+        io_dfa->prog,
+        io_dfa->prog_sz,
+        o_matches,
+        i_matches_sz,
+        (unanchored ? REX_VM_UNANCHORED : 0) |
+            (io_dfa->bytes ? REX_VM_BYTES : 0),
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        o_match_found
     );
-    if (io_vm->l == 0 && io_vm->string_sz - io_vm->cpi != 0) io_vm->halted =1;
-    /* TODO:
-     * If we dont want it to be halted after finishing prog
-     * maybe remove? */
-    if (io_vm->clist.thread_count == 0) io_vm->halted =1;
+}
 
-    io_vm->ti = 0;
+/* Same as rex_vm_exec for the program of io_dfa */
+int
+rex_two_phase_exec(
+    rex_vm_t * const io_vm,
+    rex_dfa_t * const io_dfa,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    rex_match_t * const o_matches,
+    const size_t i_matches_sz,
+    int * const o_match_found
+){
+    return rex_two_phase_run(
+        io_vm,
+        io_dfa,
+        NULL,
+        0,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        o_matches,
+        i_matches_sz,
+        0,
+        o_match_found
+    );
+}
 
-    return REX_SUCESS;
+/* Same as rex_vm_search for the program of io_dfa */
+int
+rex_two_phase_search(
+    rex_vm_t * const io_vm,
+    rex_dfa_t * const io_dfa,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    rex_match_t * const o_matches,
+    const size_t i_matches_sz,
+    int * const o_match_found
+){
+    return rex_two_phase_run(
+        io_vm,
+        io_dfa,
+        NULL,
+        0,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        o_matches,
+        i_matches_sz,
+        1,
+        o_match_found
+    );
 }
-static int
-rex_vm_exec_init(
-    rex_vm_t * o_vm,
-    void * i_memory,
-    size_t i_memory_sz,
+
+/* 
+ * Same as rex_vm_search for the program of io_dfa
+ * i_reverse_prog is the same pattern compiled with rex_ast_compile_reverse
+ */
+int
+rex_two_phase_search_reverse(
+    rex_vm_t * const io_vm,
+    rex_dfa_t * const io_dfa,
+    const rex_instruction_t * const i_reverse_prog,
+    const size_t i_reverse_prog_sz,
     const char * const i_string,
     const size_t i_string_sz,
     const size_t i_string_start,
-    const rex_instruction_t * const i_prog,
-    const size_t i_prog_sz,
-    rex_match_t * o_matches,
-    size_t i_matches_sz
-    ){
-    if (!o_vm || !i_string || !i_prog ) return REX_BAD_PARAM;
-    
-    o_vm->thread_sz = i_matches_sz * 2 * sizeof(char *) + sizeof(uint32_t);
-    
-    if (o_vm->thread_sz * i_prog_sz * 2 > o_vm->memory_sz) return REX_OUT_OF_MEMORY;
+    rex_match_t * const o_matches,
+    const size_t i_matches_sz,
+    int * const o_match_found
+){
+    if (!i_reverse_prog) return REX_BAD_PARAM;
+    return rex_two_phase_run(
+        io_vm,
+        io_dfa,
+        i_reverse_prog,
+        i_reverse_prog_sz,
+        i_string,
+        i_string_sz,
+        i_string_start,
+        o_matches,
+        i_matches_sz,
+        1,
+        o_match_found
+    );
+}
 
-    REX_MEMSET(o_vm, 0, sizeof(rex_vm_t));
-    o_vm->memory = i_memory;
-    o_vm->memory_sz = i_memory_sz;
-    o_vm->string = i_string;
-    /*TODO: Did not halt on string_sz 0 */
-    o_vm->string_sz = i_string_sz;
-    o_vm->string_start = i_string_start;
-    o_vm->cpi = i_string_start;
-    o_vm->prog = i_prog;
-    o_vm->matches = o_matches;
-    o_vm->matches_sz = i_matches_sz;
+/* REX DFA TABLE */
 
-    REX_MEMSET(o_matches, 0, sizeof(rex_match_t)*i_matches_sz);
+/*
+ * A DFA table is a complete, minimized DFA built ahead of time by exploring
+ * every state of a lazy DFA. It answers if a program matches at a position.
+ *
+ * Row 0 is the dead state and row 1 the accept state, both absorb every
+ * transition. A state that matches before a codepoint goes to the accept
+ * state, so the matching loop is a single table lookup per codepoint and the
+ * answer is read after taking the end of string column.
+ *
+ * Transitions are stored as row offsets and ascii_class as column indexes,
+ * so the next state is next[state + ascii_class[byte]].
+ */
+typedef struct rex_dfa_table_s rex_dfa_table_t;
 
-    /* Can look back one byte as any valid unicode byte will return false */
-    o_vm->prev_word = 
-        o_vm->cpi == 0 ? 0 : REX_ISWORD(o_vm->string[o_vm->cpi - 1]);
+struct rex_dfa_table_s
+{
+    uint32_t * bounds;
+    size_t class_count;
+    uint32_t * ascii_class;
+    uint32_t * next;
+    size_t state_count;
+    /* Indexed by at start << 1 | previous byte is a word character */
+    uint32_t starts[4];
+    /* Built from a byte program, ascii_class covers every byte */
+    uint8_t bytes;
+};
 
+#define REX_DFA_TABLE_DEAD      (0)
+#define REX_DFA_TABLE_ACCEPT    (1)
 
-    /* Put a thread with pc = 0 */
-    o_vm->clist.buffer = o_vm->memory;
-    *(uint32_t*)o_vm->clist.buffer = 0;
-    o_vm->clist.thread_count = 1;
-    o_vm->clist.marker_count = o_vm->matches_sz * 2;
+/* 
+ * Partition refinement, Moore's algorithm
+ * io_next holds state indexes, row i_state_count gets the block of each state
+ * Blocks are numbered by their first state so dead and accept keep 0 and 1
+ * Returns the block count
+ */
+static size_t
+rex_dfa_table_minimize(
+    uint32_t * const io_next,
+    const size_t i_state_count,
+    const size_t i_width,
+    uint32_t * const io_block,
+    uint32_t * const io_new_block,
+    uint32_t * const io_reps
+){
+    size_t i, j, c, blocks, prev_blocks;
+    const uint32_t * row, * rep_row;
 
-    o_vm->nlist.buffer = ((uint8_t*)o_vm->memory) + o_vm->memory_sz/2;
-    o_vm->nlist.thread_count = 0;
-    o_vm->nlist.marker_count = o_vm->matches_sz * 2;
+    for (i = 0, blocks = 0; i < i_state_count; i++)
+    {
+        io_block[i] = io_next[i * i_width + i_width - 1];
+        blocks = REX_MAX(blocks, io_block[i] + 1);
+    }
 
-    o_vm->cthread = o_vm->clist.buffer;
+    do
+    {
+        prev_blocks = blocks;
+        for (i = 0, blocks = 0; i < i_state_count; i++)
+        {
+            row = io_next + i * i_width;
+            for (j = 0; j < blocks; j++)
+            {
+                rep_row = io_next + io_reps[j] * i_width;
+                if (io_block[io_reps[j]] != io_block[i]) continue;
+                for (c = 0; c < i_width; c++)
+                    if (io_block[rep_row[c]] != io_block[row[c]]) break;
+                if (c == i_width) break;
+            }
+            if (j == blocks) io_reps[blocks++] = i;
+            io_new_block[i] = j;
+        }
+        REX_MEMCPY(io_block, io_new_block, sizeof(uint32_t) * i_state_count);
+    } while (blocks != prev_blocks);
+
+    /* Representatives are ascending so rows can be moved down in place */
+    for (j = 0; j < blocks; j++)
+    {
+        row = io_next + io_reps[j] * i_width;
+        for (c = 0; c < i_width; c++)
+            io_next[j * i_width + c] = io_block[row[c]];
+    }
+    return blocks;
+}
+
+/* 
+ * Builds a DFA table for the program of io_dfa
+ * io_dfa is used as scratch and must hold every state of the DFA
+ * The table is refused with REX_OUT_OF_MEMORY when it has more than
+ * i_max_states states or does not fit in i_memory
+ *
+ * Memory Layout
+ *
+ * uint32_t[class_count] : class bounds
+ * uint32_t[128] : column of every ascii codepoint, every byte for bytes
+ * uint32_t[state_count * (class_count + 1)] : transitions
+ *
+ * Building needs 3 more words per unminimized state
+ */
+int
+rex_dfa_table_compile(
+    rex_dfa_table_t * const o_table,
+    void * const i_memory,
+    const size_t i_memory_sz,
+    rex_dfa_t * const io_dfa,
+    const size_t i_max_states
+){
+    static const uint8_t start_contexts[3][2] = {{1, 0}, {0, 0}, {0, 1}};
+    uint32_t * mem = i_memory;
+    uint32_t * state, * next;
+    uint32_t t;
+    size_t i, c, offset, width, count, clears, direct;
+    int r;
 
-    if (o_vm->clist.marker_count)
-        REX_MARKERS(o_vm->cthread)[0] = o_vm->string + o_vm->cpi;
+    if (!o_table || !i_memory || !io_dfa) return REX_BAD_PARAM;
+    direct = io_dfa->bytes ? 256 : 128;
 
-    rex_vm_thread_expand(
-        &o_vm->clist, 
-        0,
-        i_prog,
-        i_string + o_vm->cpi
-    );
-    o_vm->l = rex_parse_utf8_codepoint(
-        i_string + o_vm->cpi,
-        i_string_sz - o_vm->cpi,
-        &o_vm->cp
+    /* Explore, the arena doubles as the work list */
+    rex_dfa_cache_clear(io_dfa);
+    clears = io_dfa->cache_clears;
+    width = io_dfa->class_count + 1;
+    for (i = 0; i < 3; i++)
+    {
+        r = rex_dfa_start(
+            io_dfa,
+            start_contexts[i][0],
+            start_contexts[i][1],
+            0,
+            &o_table->starts[start_contexts[i][0] << 1 | start_contexts[i][1]]
+        );
+        if (r) return r;
+    }
+    /* At start with a previous word character cannot happen */
+    o_table->starts[3] = o_table->starts[2];
+    for (offset = 0; offset < io_dfa->arena_top;)
+    {
+        state = io_dfa->arena + offset;
+        if (io_dfa->state_count + 2 > i_max_states) return REX_OUT_OF_MEMORY;
+        for (c = 0; c < width; c++)
+        {
+            r = rex_dfa_transition(io_dfa, offset, c, &t);
+            if (r) return r;
+            if (clears != io_dfa->cache_clears) return REX_OUT_OF_MEMORY;
+        }
+        offset += 3 + io_dfa->class_count + state[1];
+    }
+
+    count = io_dfa->state_count + 2;
+    if (
+        (io_dfa->class_count + direct + count * (width + 3)) * 
+        sizeof(uint32_t) > i_memory_sz
+    ) return REX_OUT_OF_MEMORY;
+
+    o_table->class_count = io_dfa->class_count;
+    o_table->bytes = io_dfa->bytes;
+    o_table->bounds = mem;
+    REX_MEMCPY(mem, io_dfa->bounds, sizeof(uint32_t) * io_dfa->class_count);
+    mem += io_dfa->class_count;
+    o_table->ascii_class = mem;
+    REX_MEMCPY(mem, io_dfa->ascii_class, sizeof(uint32_t) * direct);
+    mem += direct;
+    o_table->next = next = mem;
+
+    /* Number the states, flags are no longer needed */
+    for (offset = 0, i = 2; offset < io_dfa->arena_top; i++)
+    {
+        state = io_dfa->arena + offset;
+        state[0] = i;
+        offset += 3 + io_dfa->class_count + state[1];
+    }
+
+    for (i = 0; i < width; i++)
+    {
+        next[REX_DFA_TABLE_DEAD * width + i] = REX_DFA_TABLE_DEAD;
+        next[REX_DFA_TABLE_ACCEPT * width + i] = REX_DFA_TABLE_ACCEPT;
+    }
+    for (offset = 0, i = 2; offset < io_dfa->arena_top; i++)
+    {
+        state = io_dfa->arena + offset;
+        for (c = 0; c < width; c++)
+        {
+            t = REX_DFA_STATE_TRANSITIONS(state)[c];
+            if (t & REX_DFA_MATCH) t = REX_DFA_TABLE_ACCEPT;
+            else if (t == REX_DFA_DEAD) t = REX_DFA_TABLE_DEAD;
+            else t = io_dfa->arena[t];
+            next[i * width + c] = t;
+        }
+        offset += 3 + io_dfa->class_count + state[1];
+    }
+    for (i = 0; i < 4; i++)
+    {
+        t = o_table->starts[i];
+        o_table->starts[i] = 
+            t == REX_DFA_DEAD ? REX_DFA_TABLE_DEAD : io_dfa->arena[t];
+    }
+
+    o_table->state_count = rex_dfa_table_minimize(
+        next,
+        count,
+        width,
+        next + count * width,
+        next + count * (width + 1),
+        next + count * (width + 2)
     );
-    if (o_vm->l == 0 && i_string_sz - o_vm->cpi != 0) o_vm->halted =1;
-    /* TODO:
-     * If we dont want it to be halted after finishing prog
-     * maybe remove? */
-    if (o_vm->clist.thread_count == 0) o_vm->halted =1;
-    return REX_SUCESS;
+    for (i = 0; i < 4; i++)
+        o_table->starts[i] = next[count * width + o_table->starts[i]] * width;
+    for (i = 0; i < o_table->state_count * width; i++)
+        next[i] *= width;
 
+    /* The previous state of the cache is gone */
+    rex_dfa_cache_clear(io_dfa);
+    return REX_SUCESS;
 }
 
 /* 
- * NOTES:
- * MARKER REGISTERS 0 and 1 are reserved for pattern match
- * If i_matches_sz is greater than actual submatch count
- * extra matches are undefined
+ * Matches at i_string_start like rex_vm_exec without reporting bounds
  */
-
 int
-rex_vm_exec(
-    rex_vm_t * io_vm,
+rex_dfa_table_exec(
+    const rex_dfa_table_t * const i_table,
     const char * const i_string,
     const size_t i_string_sz,
     const size_t i_string_start,
-    const rex_instruction_t * const i_prog,
-    const size_t i_prog_sz,
-    rex_match_t * o_matches,
-    size_t i_matches_sz,
-    int * o_match_found
-)
+    int * const o_match_found
+){
+    const uint8_t * const str = (const uint8_t *) i_string;
+    const uint32_t * next, * ascii_class;
+    uint32_t state, accept, cp;
+    size_t pos, l;
+
+    if (!i_table || !i_string || !o_match_found) return REX_BAD_PARAM;
+    next = i_table->next;
+    ascii_class = i_table->ascii_class;
+    accept = REX_DFA_TABLE_ACCEPT * (i_table->class_count + 1);
+
+    state = i_table->starts[
+        (i_string_start == 0) << 1 |
+        (i_string_start == 0 ? 0 : REX_ISWORD(i_string[i_string_start - 1]))
+    ];
+    for (pos = i_string_start; pos < i_string_sz && str[pos];)
+    {
+        if (!REX_UTF8_IS_MULTIBYTE(str[pos]) || i_table->bytes)
+        {
+            state = next[state + ascii_class[str[pos++]]];
+            continue;
+        }
+        l = rex_parse_utf8_codepoint(i_string + pos, i_string_sz - pos, &cp);
+        if (l == 0)
+        {
+            *o_match_found = state == accept;
+            return REX_SUCESS;
+        }
+        state = next[
+            state + rex_class_of(i_table->bounds, i_table->class_count, cp)
+        ];
+        pos += l;
+    }
+    *o_match_found = next[state + i_table->class_count] == accept;
+    return REX_SUCESS;
+}
+
+/* REX ONE-PASS */
+
+/*
+ * A program is one-pass when at every position at most one thread can
+ * consume the next codepoint. Such a program is run with a single set of
+ * markers and no thread lists.
+ *
+ * A node is pc 0 or the pc following an advancing instruction. For every node
+ * the analysis walks the threads reachable without consuming and records, per
+ * codepoint class, the one thread that advances along with the submatches it
+ * saves and the assertions it passed. A match found in the walk is recorded
+ * the same way and cuts the threads found after it when it is taken.
+ *
+ * The analysis refuses with REX_UNSUPPORTED_PROGRAM when two threads advance
+ * on a class, when the walk reaches a pc twice or saves a marker past 31.
+ */
+typedef struct rex_onepass_s rex_onepass_t;
+
+struct rex_onepass_s
 {
-    int r;
-    if (!io_vm || !i_string || !i_prog ) return REX_BAD_PARAM;
-    r = rex_vm_exec_init(
-        io_vm,
-        io_vm->memory,
-        io_vm->memory_sz,
-        i_string,
-        i_string_sz,
-        i_string_start,
-        i_prog,
-        i_prog_sz,
-        o_matches,
-        i_matches_sz
-    );
-    if (r) return r;
+    void * memory;
+    size_t memory_sz;
+    uint32_t * bounds;
+    size_t class_count;
+    uint32_t * ascii_class;
+    uint32_t * actions;
+    size_t node_count;
+};
 
-    while (
-        (r = rex_vm_exec_step(io_vm))==0 && !io_vm->halted
-    );
-    if (o_match_found) *o_match_found = io_vm->match;
+/* Action Layout
+ *
+ * uint32_t : next node, conditions and the cut flag, REX_ONEPASS_NONE if empty
+ * uint32_t : markers saved
+ *
+ * Every node has class_count actions followed by its match action
+ */
+#define REX_ONEPASS_NONE            (0xFFFFFFFF)
+#define REX_ONEPASS_NODE_MASK       (0x00FFFFFF)
+#define REX_ONEPASS_COND_START      (0x01000000)
+#define REX_ONEPASS_COND_END        (0x02000000)
+#define REX_ONEPASS_COND_WB         (0x04000000)
+#define REX_ONEPASS_COND_NWB        (0x08000000)
+#define REX_ONEPASS_COND_MASK       (0x0F000000)
+#define REX_ONEPASS_CUT             (0x10000000)
+#define REX_ONEPASS_MAX_MARKERS     (32)
 
-    return r;
+/* 
+ * Programs testing sets of a constant pool are REX_UNSUPPORTED_PROGRAM
+ *
+ * Memory Layout
+ *
+ * uint32_t[REX_PROG_CLASSES_MAX(prog_sz)] : class bounds
+ * uint32_t[128] : class of every ascii codepoint
+ * uint32_t[prog_sz] : node of every pc
+ * uint32_t[prog_sz] : pc of every node
+ * uint32_t[prog_sz] : last node to visit a pc
+ * uint32_t[prog_sz * 3] : walk stack
+ * uint32_t[] : actions, node_count * (class_count + 1) * 2
+ */
+int
+rex_onepass_compile(
+    rex_onepass_t * const o_onepass,
+    void * const i_memory,
+    const size_t i_memory_sz,
+    const rex_instruction_t * const i_prog,
+    const size_t i_prog_sz
+){
+    uint32_t * mem = i_memory;
+    uint32_t * node_of, * node_pc, * visited, * stack, * row;
+    uint32_t inst, imm, pc, cond, markers, next, node, cut;
+    size_t words, fixed, width, capacity, sp, i, c;
+    int r;
+
+    if (!o_onepass || !i_memory || !i_prog) return REX_BAD_PARAM;
+    if (i_prog_sz >= REX_ONEPASS_NODE_MASK) return REX_UNSUPPORTED_PROGRAM;
+
+    words = i_memory_sz / sizeof(uint32_t);
+    fixed = REX_PROG_CLASSES_MAX(i_prog_sz) + 128 + i_prog_sz * 6;
+    if (fixed > words) return REX_OUT_OF_MEMORY;
+
+    REX_MEMSET(o_onepass, 0, sizeof(rex_onepass_t));
+    o_onepass->memory = i_memory;
+    o_onepass->memory_sz = i_memory_sz;
+
+    o_onepass->bounds = mem;
+    o_onepass->class_count = rex_prog_classes(i_prog, i_prog_sz, 0, mem);
+    if (o_onepass->class_count == 0) return REX_UNSUPPORTED_PROGRAM;
+    mem += REX_PROG_CLASSES_MAX(i_prog_sz);
+    o_onepass->ascii_class = mem;
+    for (i = 0; i < 128; i++)
+        mem[i] = rex_class_of(o_onepass->bounds, o_onepass->class_count, i);
+    mem += 128;
+    node_of = mem;
+    node_pc = mem + i_prog_sz;
+    visited = mem + i_prog_sz * 2;
+    stack = mem + i_prog_sz * 3;
+    mem += i_prog_sz * 6;
+    o_onepass->actions = mem;
+
+    width = (o_onepass->class_count + 1) * 2;
+    capacity = (words - fixed) / width;
+    if (capacity == 0) return REX_OUT_OF_MEMORY;
+    REX_MEMSET(node_of, 0xFF, sizeof(uint32_t) * i_prog_sz);
+    REX_MEMSET(visited, 0xFF, sizeof(uint32_t) * i_prog_sz);
+    REX_MEMSET(o_onepass->actions, 0xFF, sizeof(uint32_t) * width);
+    node_of[0] = 0;
+    node_pc[0] = 0;
+    o_onepass->node_count = 1;
+
+    /* Nodes double as the work list */
+    for (node = 0; node < o_onepass->node_count; node++)
+    {
+        row = o_onepass->actions + node * width;
+        cut = 0;
+        sp = 0;
+        pc = node_pc[node];
+        cond = 0;
+        markers = 0;
+        for (;;)
+        {
+            if (pc >= i_prog_sz) return REX_BAD_INSTRUCTION;
+            if (visited[pc] == node) return REX_UNSUPPORTED_PROGRAM;
+            visited[pc] = node;
+            inst = i_prog[pc];
+            imm = REX_IMM_FROM_INST(inst);
+            switch (REX_OP_FROM_INST(inst))
+            {
+            case REX_OPCODE_J:
+                pc = imm;
+                continue;
+            case REX_OPCODE_B:
+                stack[sp++] = imm;
+                stack[sp++] = cond;
+                stack[sp++] = markers;
+                pc++;
+                continue;
+            case REX_OPCODE_BWP:
+                stack[sp++] = pc + 1;
+                stack[sp++] = cond;
+                stack[sp++] = markers;
+                pc = imm;
+                continue;
+            case REX_OPCODE_SS:
+                if (imm >= REX_ONEPASS_MAX_MARKERS) 
+                    return REX_UNSUPPORTED_PROGRAM;
+                markers |= (uint32_t)1 << imm;
+                pc++;
+                continue;
+            case REX_OPCODE_AS:
+                cond |= REX_ONEPASS_COND_START;
+                pc++;
+                continue;
+            case REX_OPCODE_AE:
+                cond |= REX_ONEPASS_COND_END;
+                pc++;
+                continue;
+            case REX_OPCODE_AWB:
+                cond |= REX_ONEPASS_COND_WB;
+                pc++;
+                continue;
+            case REX_OPCODE_ANWB:
+                cond |= REX_ONEPASS_COND_NWB;
+                pc++;
+                continue;
+            case REX_OPCODE_M:
+                if (row[width - 2] != REX_ONEPASS_NONE) 
+                    return REX_UNSUPPORTED_PROGRAM;
+                row[width - 2] = cond;
+                row[width - 1] = markers;
+                cut = REX_ONEPASS_CUT;
+                break;
+            default:
+                for (c = 0; c < o_onepass->class_count; c++)
+                {
+                    /* NUL ends the string and is never consumed */
+                    if (o_onepass->bounds[c] == 0) continue;
+                    r = rex_prog_chain_step(
+                        i_prog,
+                        i_prog_sz,
+                        pc,
+                        o_onepass->bounds[c],
+                        &next
+                    );
+                    if (r) return r;
+                    if (next == REX_PC_HALTED) continue;
+                    if (row[c * 2] != REX_ONEPASS_NONE)
+                        return REX_UNSUPPORTED_PROGRAM;
+                    if (next >= i_prog_sz) return REX_BAD_INSTRUCTION;
+                    if (node_of[next] == REX_ONEPASS_NONE)
+                    {
+                        if (o_onepass->node_count == capacity) 
+                            return REX_OUT_OF_MEMORY;
+                        node_of[next] = o_onepass->node_count;
+                        node_pc[o_onepass->node_count] = next;
+                        REX_MEMSET(
+                            o_onepass->actions + o_onepass->node_count * width,
+                            0xFF,
+                            sizeof(uint32_t) * width
+                        );
+                        o_onepass->node_count++;
+                    }
+                    row[c * 2] = node_of[next] | cond | cut;
+                    row[c * 2 + 1] = markers;
+                }
+                break;
+            }
+            if (sp == 0) break;
+            markers = stack[--sp];
+            cond = stack[--sp];
+            pc = stack[--sp];
+        }
+    }
+    return REX_SUCESS;
 }
 
+/* 
+ * Matches at i_string_start like rex_vm_exec
+ * At most REX_ONEPASS_MAX_MARKERS / 2 submatches are reported
+ */
+int
+rex_onepass_exec(
+    const rex_onepass_t * const i_onepass,
+    const char * const i_string,
+    const size_t i_string_sz,
+    const size_t i_string_start,
+    rex_match_t * const o_matches,
+    size_t i_matches_sz,
+    int * const o_match_found
+){
+    const uint8_t * const str = (const uint8_t *) i_string;
+    const char * markers[REX_ONEPASS_MAX_MARKERS] = {0};
+    const char * m0, * m1;
+    const uint32_t * row;
+    size_t width, pos, l, cls, mi;
+    uint32_t cp, ctx, action, node;
+    uint8_t prev_word, next_word, at_end, matched;
+
+    if (!i_onepass || !i_string || !o_match_found) return REX_BAD_PARAM;
+    if (i_matches_sz && !o_matches) return REX_BAD_PARAM;
+
+    i_matches_sz = REX_MIN(i_matches_sz, REX_ONEPASS_MAX_MARKERS / 2);
+    REX_MEMSET(o_matches, 0, sizeof(rex_match_t) * i_matches_sz);
+    *o_match_found = 0;
+
+    width = (i_onepass->class_count + 1) * 2;
+    markers[0] = i_string + i_string_start;
+    /* Can look back one byte as any valid unicode byte will return false */
+    prev_word = i_string_start ? REX_ISWORD(i_string[i_string_start - 1]) : 0;
+    node = 0;
+    for (pos = i_string_start;; pos += l)
+    {
+        at_end = pos >= i_string_sz || str[pos] == 0;
+        cp = 0;
+        l = 0;
+        cls = 0;
+        if (!at_end)
+        {
+            if (!REX_UTF8_IS_MULTIBYTE(str[pos]))
+            {
+                cp = str[pos];
+                cls = i_onepass->ascii_class[cp];
+                l = 1;
+            }else{
+                l = rex_parse_utf8_codepoint(
+                    i_string + pos,
+                    i_string_sz - pos,
+                    &cp
+                );
+                if (l == 0) break;
+                cls = rex_class_of(
+                    i_onepass->bounds,
+                    i_onepass->class_count,
+                    cp
+                );
+            }
+        }
+        next_word = REX_ISWORD(cp);
+        ctx = 0;
+        if (pos == 0) ctx |= REX_ONEPASS_COND_START;
+        if (at_end) ctx |= REX_ONEPASS_COND_END;
+        ctx |= prev_word != next_word ? 
+            REX_ONEPASS_COND_WB : REX_ONEPASS_COND_NWB;
+
+        row = i_onepass->actions + node * width;
+        matched = 0;
+        action = row[width - 2];
+        if (action != REX_ONEPASS_NONE && !(action & ~ctx))
+        {
+            matched = 1;
+            *o_match_found = 1;
+            for (mi = 0; mi < i_matches_sz * 2; mi += 2)
+            {
+                m0 = row[width - 1] & ((uint32_t)1 << mi) ? 
+                    i_string + pos : markers[mi];
+                m1 = mi == 0 || row[width - 1] & ((uint32_t)1 << (mi + 1)) ? 
+                    i_string + pos : markers[mi + 1];
+                o_matches[mi / 2] = (rex_match_t){m0, m1 - m0};
+            }
+        }
+        if (at_end) break;
+
+        action = row[cls * 2];
+        if (action == REX_ONEPASS_NONE) break;
+        if (action & ~ctx & REX_ONEPASS_COND_MASK) break;
+        if (matched && action & REX_ONEPASS_CUT) break;
+        for (mi = 0; mi < i_matches_sz * 2; mi++)
+            if (row[cls * 2 + 1] & ((uint32_t)1 << mi)) 
+                markers[mi] = i_string + pos;
+        node = action & REX_ONEPASS_NODE_MASK;
+        prev_word = next_word;
+    }
+    return REX_SUCESS;
+}
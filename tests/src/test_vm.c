@@ -138,11 +138,11 @@ int test_alphanumeric_single(void)
     matches = 0;
     int match, err;
     int ret = 0;
-    uint8_t buffer[128];
+    uint8_t buffer[1024];
     rex_vm_t  vm;
     
     vm.memory = buffer;
-    vm.memory_sz = 128;
+    vm.memory_sz = 1024;
     for (i = 0; i < 63; i++)
     {
         err = rex_vm_exec(
@@ -223,7 +223,7 @@ test_alphanumeric_random_sequence_offset(void)
     int match, err;
     int ret = 0;
     int ri;
-    uint8_t buffer[512];
+    uint8_t buffer[1024];
     rex_vm_t  vm;
     char test_str[TEST_STR_SZ] = {0};
     rex_match_t extract;  
@@ -231,7 +231,7 @@ test_alphanumeric_random_sequence_offset(void)
     matches = 1;
 
     vm.memory = buffer;
-    vm.memory_sz = 512;
+    vm.memory_sz = 1024;
 
     for ( i = 0; i < 1024; i++){
         for ( j = 0; j < TEST_STR_SZ-1; j++)
@@ -278,12 +278,12 @@ test_alphanumeric_random_sequence(void)
     int match, err;
     int ret = 0;
     int ri;
-    uint8_t buffer[128];
+    uint8_t buffer[1024];
     rex_vm_t  vm;
     char test_str[TEST_STR_SZ] = {0};
 
     vm.memory = buffer;
-    vm.memory_sz = 128;
+    vm.memory_sz = 1024;
 
     for ( i = 0; i < 1024; i++){
         for ( j = 0; j < TEST_STR_SZ-1; j++)
@@ -326,11 +326,11 @@ int test_nonalphanumeric(void)
     matches = 0;
     int match, err;
     int ret = 0;
-    uint8_t buffer[128];
+    uint8_t buffer[1024];
     rex_vm_t  vm;
     
     vm.memory = buffer;
-    vm.memory_sz = 128;
+    vm.memory_sz = 1024;
     for (i = 0; i < 22; i++)
     {
         err = rex_vm_exec(
@@ -640,11 +640,11 @@ int test_misc_symbol_single(void)
     matches = 0;
     int match, err;
     int ret = 0;
-    uint8_t buffer[128];
+    uint8_t buffer[1024];
     rex_vm_t  vm;
     
     vm.memory = buffer;
-    vm.memory_sz = 128;
+    vm.memory_sz = 1024;
     for (i = 0; i < 0x100; i++)
     {
         err = rex_vm_exec(
@@ -682,12 +682,12 @@ test_misc_symbol_random_sequence(void)
     int match, err;
     int ret = 0;
     int ri;
-    uint8_t buffer[128];
+    uint8_t buffer[1024];
     rex_vm_t  vm;
     char test_str[TEST_STR_SZ] = {0};
 
     vm.memory = buffer;
-    vm.memory_sz = 128;
+    vm.memory_sz = 1024;
 
     for ( i = 0; i < 1024; i++){
         for ( j = 0; j < TEST_STR_SZ-4; j+=3)
@@ -732,11 +732,11 @@ int test_not_misc_symbol(void)
     matches = 0;
     int match, err;
     int ret = 0;
-    uint8_t buffer[128];
+    uint8_t buffer[1024];
     rex_vm_t  vm;
     
     vm.memory = buffer;
-    vm.memory_sz = 128;
+    vm.memory_sz = 1024;
     for (i = 0; i < 22; i++)
     {
         err = rex_vm_exec(
@@ -935,13 +935,13 @@ test_alphanumeric_random_sequence_with_submatches(void)
     int match, err;
     int ret = 0;
     int ri;
-    uint8_t buffer[4096];
+    uint8_t buffer[8192];
     rex_vm_t  vm;
     char test_str[TEST_STR_SZ] = {0};
     rex_match_t extract[3];
 
     vm.memory = buffer;
-    vm.memory_sz = 4096;
+    vm.memory_sz = 8192;
 
     for ( i = 0; i < 1024; i++){
         for ( j = 0; j < TEST_STR_SZ-1; j++)
@@ -1223,6 +1223,1581 @@ test_word_boundary_assertions(void)
 }
 
 
+/* ab+ */
+const uint32_t a_then_bs[4] ={
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'a'), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'b'), 
+    REX_INSTRUCTION(REX_OPCODE_BWP, 1), 
+    REX_INSTRUCTION(REX_OPCODE_M, 0) 
+};
+
+int
+test_search(void)
+{
+    char text[] = "xaxaab abbbx";
+    int err;
+    int ret = 0;
+    uint8_t buffer[1024];
+    rex_vm_t  vm;
+    rex_match_t extract;
+    int match;
+
+    vm.memory = buffer;
+    vm.memory_sz = 1024;
+
+    /* Leftmost match wins over the longer one */
+    err = rex_vm_search(&vm, text, SIZE_MAX, 0, a_then_bs, 4, &extract, 1, &match);
+    ret |= err || !match;
+    ret |= extract.match != text + 4 || extract.match_sz != 2;
+
+    err = rex_vm_search(&vm, text, SIZE_MAX, 6, a_then_bs, 4, &extract, 1, &match);
+    ret |= err || !match;
+    ret |= extract.match != text + 7 || extract.match_sz != 4;
+
+    /* Match would extend past the string size */
+    err = rex_vm_search(&vm, text, 9, 6, a_then_bs, 4, &extract, 1, &match);
+    ret |= err || !match;
+    ret |= extract.match != text + 7 || extract.match_sz != 2;
+
+    err = rex_vm_search(&vm, text, 8, 6, a_then_bs, 4, &extract, 1, &match);
+    ret |= err || match;
+
+    err = rex_vm_search(&vm, "", SIZE_MAX, 0, a_then_bs, 4, &extract, 1, &match);
+    ret |= err || match;
+
+    /* Anchors are still honoured */
+    err = rex_vm_search(&vm, "AAB", SIZE_MAX, 0, start_end_assertion, 4, NULL, 0, &match);
+    ret |= err || match;
+
+    err = rex_vm_search(&vm, text, SIZE_MAX, 0, not_word_boundary, 4, &extract, 1, &match);
+    ret |= err || !match;
+    ret |= extract.match != text + 1 || extract.match_sz != 1;
+
+    printf(
+        "UNANCHORED SEARCH: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+int
+test_dfa(void)
+{
+    char text[] = "ABC abc_1234 _ 1234 abc/def /abc";
+    char search_text[] = "xaxaab abbbx";
+    size_t cpi, end;
+    int err = 0;
+    int ret = 0;
+    uint8_t buffer[4096];
+    uint8_t vm_buffer[1024];
+    rex_dfa_t dfa;
+    rex_vm_t vm;
+    rex_match_t extract, vm_extract;
+    int match, vm_match;
+
+    vm.memory = vm_buffer;
+    vm.memory_sz = 1024;
+
+    /* Agrees with the VM at every offset */
+    err = rex_dfa_init(&dfa, buffer, 4096, not_word_boundary, 4);
+    ret |= err;
+    for (cpi = 0; text[cpi] && !ret; cpi++)
+    {
+        err = rex_dfa_exec(&dfa, text, SIZE_MAX, cpi, &extract, &match);
+        ret |= err;
+        err = rex_vm_exec(&vm, text, SIZE_MAX, cpi, not_word_boundary, 4,
+            &vm_extract, 1, &vm_match);
+        ret |= err || match != vm_match;
+        ret |= match && (extract.match != vm_extract.match ||
+            extract.match_sz != vm_extract.match_sz);
+    }
+
+    /* Barely enough memory for the cache, states are rebuilt */
+    err = rex_dfa_init(&dfa, buffer, 880, a_then_bs, 4);
+    ret |= err;
+    err = rex_dfa_search(&dfa, search_text, SIZE_MAX, 0, &end, &match);
+    ret |= err || !match || end != 6;
+    err = rex_dfa_search(&dfa, search_text, SIZE_MAX, 6, &end, &match);
+    ret |= err || !match || end != 11;
+    err = rex_dfa_search(&dfa, search_text, 8, 6, &end, &match);
+    ret |= err || match;
+    err = rex_dfa_exec(&dfa, search_text, SIZE_MAX, 7, &extract, &match);
+    ret |= err || !match;
+    ret |= extract.match != search_text + 7 || extract.match_sz != 4;
+    ret |= dfa.cache_clears == 0;
+
+    /* Cannot hold a single state */
+    ret |= rex_dfa_init(&dfa, buffer, 776, a_then_bs, 4) != REX_SUCESS;
+    ret |= rex_dfa_search(&dfa, search_text, SIZE_MAX, 0, &end, &match)
+        != REX_OUT_OF_MEMORY;
+
+    printf(
+        "LAZY DFA: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+int
+test_dfa_table(void)
+{
+    char text[] = "ABC abc_1234 _ 1234 abc/def /abc";
+    char ab_text[] = "xaxaab abbbx";
+    size_t cpi;
+    int err = 0;
+    int ret = 0;
+    uint8_t buffer[4096];
+    uint8_t table_buffer[4096];
+    uint8_t vm_buffer[1024];
+    rex_dfa_t dfa;
+    rex_dfa_table_t table;
+    rex_vm_t vm;
+    int match, vm_match;
+
+    vm.memory = vm_buffer;
+    vm.memory_sz = 1024;
+
+    /* Agrees with the VM at every offset */
+    err = rex_dfa_init(&dfa, buffer, 4096, word_boundary, 9);
+    ret |= err;
+    err = rex_dfa_table_compile(&table, table_buffer, 4096, &dfa, 64);
+    ret |= err;
+    for (cpi = 0; text[cpi] && !ret; cpi++)
+    {
+        err = rex_dfa_table_exec(&table, text, SIZE_MAX, cpi, &match);
+        ret |= err;
+        err = rex_vm_exec(&vm, text, SIZE_MAX, cpi, word_boundary, 9,
+            NULL, 0, &vm_match);
+        ret |= err || match != vm_match;
+    }
+
+    err = rex_dfa_init(&dfa, buffer, 4096, a_then_bs, 4);
+    ret |= err;
+    err = rex_dfa_table_compile(&table, table_buffer, 4096, &dfa, 64);
+    ret |= err;
+    /* dead, accept, before a and before b */
+    ret |= table.state_count != 4;
+    for (cpi = 0; ab_text[cpi] && !ret; cpi++)
+    {
+        err = rex_dfa_table_exec(&table, ab_text, SIZE_MAX, cpi, &match);
+        ret |= err;
+        ret |= match != (cpi == 4 || cpi == 7);
+    }
+    err = rex_dfa_table_exec(&table, ab_text, 5, 4, &match);
+    ret |= err || match;
+
+    /* Size cap */
+    ret |= rex_dfa_table_compile(&table, table_buffer, 4096, &dfa, 3) 
+        != REX_OUT_OF_MEMORY;
+    ret |= rex_dfa_table_compile(&table, table_buffer, 600, &dfa, 64) 
+        != REX_OUT_OF_MEMORY;
+
+    printf(
+        "DFA TABLE: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+/* (\d+)-(\d+) */
+const uint32_t digits_dash_digits[16] ={
+    REX_INSTRUCTION(REX_OPCODE_SS, 2), 
+    REX_INSTRUCTION(REX_OPCODE_LR, '0' - 1), 
+    REX_INSTRUCTION(REX_OPCODE_HR, 0), 
+    REX_INSTRUCTION(REX_OPCODE_LR, REX_MAX_UNICODE_VAL), 
+    REX_INSTRUCTION(REX_OPCODE_HRA, '9' + 1), 
+    REX_INSTRUCTION(REX_OPCODE_BWP, 1), 
+    REX_INSTRUCTION(REX_OPCODE_SS, 3), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, '-'), 
+    REX_INSTRUCTION(REX_OPCODE_SS, 4), 
+    REX_INSTRUCTION(REX_OPCODE_LR, '0' - 1), 
+    REX_INSTRUCTION(REX_OPCODE_HR, 0), 
+    REX_INSTRUCTION(REX_OPCODE_LR, REX_MAX_UNICODE_VAL), 
+    REX_INSTRUCTION(REX_OPCODE_HRA, '9' + 1), 
+    REX_INSTRUCTION(REX_OPCODE_BWP, 9), 
+    REX_INSTRUCTION(REX_OPCODE_SS, 5), 
+    REX_INSTRUCTION(REX_OPCODE_M, 0) 
+};
+
+/* a|ab */
+const uint32_t a_or_ab[6] ={
+    REX_INSTRUCTION(REX_OPCODE_B, 3), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'a'), 
+    REX_INSTRUCTION(REX_OPCODE_J, 5), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'a'), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'b'), 
+    REX_INSTRUCTION(REX_OPCODE_M, 0) 
+};
+
+int
+test_onepass(void)
+{
+    const char * texts[4] = {"12-345x", "12-", "-1", "7-0"};
+    size_t ti, mi;
+    int err = 0;
+    int ret = 0;
+    uint8_t buffer[4096];
+    uint8_t vm_buffer[4096];
+    rex_onepass_t onepass;
+    rex_vm_t vm;
+    rex_match_t extract[3], vm_extract[3];
+    int match, vm_match;
+
+    vm.memory = vm_buffer;
+    vm.memory_sz = 4096;
+
+    err = rex_onepass_compile(&onepass, buffer, 4096, digits_dash_digits, 16);
+    ret |= err;
+    for (ti = 0; ti < 4 && !ret; ti++)
+    {
+        err = rex_onepass_exec(&onepass, texts[ti], SIZE_MAX, 0,
+            extract, 3, &match);
+        ret |= err;
+        err = rex_vm_exec(&vm, texts[ti], SIZE_MAX, 0, digits_dash_digits, 16,
+            vm_extract, 3, &vm_match);
+        ret |= err || match != vm_match;
+        for (mi = 0; mi < 3 && match; mi++)
+            ret |= extract[mi].match != vm_extract[mi].match ||
+                extract[mi].match_sz != vm_extract[mi].match_sz;
+    }
+    ret |= extract[0].match != texts[3] || extract[0].match_sz != 3;
+    ret |= extract[2].match != texts[3] + 2 || extract[2].match_sz != 1;
+
+    err = rex_onepass_compile(&onepass, buffer, 4096, a_or_ab, 6);
+    ret |= err != REX_UNSUPPORTED_PROGRAM;
+    err = 0;
+
+    printf(
+        "ONE-PASS: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+int
+test_backtrack(void)
+{
+    const char * texts[4] = {
+        "1234567890-1234567890-1234567890-1234567890",
+        "1234567890-12345678901234567890x",
+        "1234567890_1234567890",
+        "7-0"
+    };
+    size_t ti, mi, memory_sz;
+    int err = 0;
+    int ret = 0;
+    static uint8_t buffer[65536];
+    rex_vm_t vm;
+    rex_match_t extract[3], vm_extract[3];
+    int match, vm_match;
+
+    memory_sz = rex_vm_memory_sz(16, 3);
+    for (ti = 0; ti < 4 && !ret; ti++)
+    {
+        /* Only the short string fits the backtracker in the VM memory */
+        ret |= (rex_backtrack_length(texts[ti], SIZE_MAX, 0, SIZE_MAX,
+            16, 3, memory_sz) == SIZE_MAX) != (ti != 3);
+        ret |= rex_backtrack_length(texts[ti], SIZE_MAX, 0, SIZE_MAX,
+            16, 3, 65536) != strlen(texts[ti]);
+
+        vm.memory = buffer;
+        vm.memory_sz = memory_sz;
+        err = rex_vm_search(&vm, texts[ti], SIZE_MAX, 0, digits_dash_digits, 16,
+            vm_extract, 3, &vm_match);
+        ret |= err;
+        vm.memory_sz = 65536;
+        err = rex_vm_search(&vm, texts[ti], SIZE_MAX, 0, digits_dash_digits, 16,
+            extract, 3, &match);
+        ret |= err || match != vm_match || match != (ti != 2);
+        for (mi = 0; mi < 3 && match; mi++)
+            ret |= extract[mi].match != vm_extract[mi].match ||
+                extract[mi].match_sz != vm_extract[mi].match_sz;
+    }
+
+    printf(
+        "BIT-STATE BACKTRACKER: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+int
+test_two_phase(void)
+{
+    const char * texts[3] = {
+        "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx 12-34 56-78",
+        "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx 12- 34",
+        "1-2-3"
+    };
+    size_t ti, mi;
+    int err = 0;
+    int ret = 0;
+    static uint8_t buffer[65536];
+    uint8_t dfa_buffer[4096];
+    rex_vm_t vm;
+    rex_dfa_t dfa;
+    rex_match_t extract[3], vm_extract[3];
+    int match, vm_match;
+
+    err = rex_dfa_init(&dfa, dfa_buffer, 4096, digits_dash_digits, 16);
+    ret |= err;
+    for (ti = 0; ti < 3 && !ret; ti++)
+    {
+        vm.memory = buffer;
+        vm.memory_sz = rex_vm_memory_sz(16, 3);
+        err = rex_vm_search(&vm, texts[ti], SIZE_MAX, 0, digits_dash_digits, 16,
+            vm_extract, 3, &vm_match);
+        ret |= err;
+        err = rex_two_phase_search(&vm, &dfa, texts[ti], SIZE_MAX, 0,
+            extract, 3, &match);
+        ret |= err || match != vm_match || match != (ti != 1);
+        for (mi = 0; mi < 3 && match; mi++)
+            ret |= extract[mi].match != vm_extract[mi].match ||
+                extract[mi].match_sz != vm_extract[mi].match_sz;
+    }
+    ret |= extract[0].match != texts[2] || extract[0].match_sz != 3;
+
+    err = rex_two_phase_exec(&vm, &dfa, texts[0] + 41, SIZE_MAX, 0,
+        extract, 3, &match);
+    ret |= err || !match;
+    ret |= extract[1].match != texts[0] + 41 || extract[1].match_sz != 2;
+    ret |= extract[2].match != texts[0] + 44 || extract[2].match_sz != 2;
+
+    printf(
+        "TWO-PHASE MATCHING: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+int
+test_reverse(void)
+{
+    const char text[] = "xxabbbcxabc";
+    const char pattern[] = "a(b+)c";
+    static uint8_t buffer[16384];
+    uint8_t dfa_buffer[4096];
+    rex_instruction_t prog[64] = {0};
+    rex_instruction_t reverse_prog[64] = {0};
+    size_t prog_sz, reverse_prog_sz, start, dfa_sz;
+    int err = 0;
+    int ret = 0;
+    rex_compiler_t compiler;
+    rex_vm_t vm;
+    rex_dfa_t dfa;
+    rex_match_t extract[2];
+    int match;
+
+    compiler.memory = buffer;
+    compiler.memory_sz = 16384;
+    err = rex_build_ast(pattern, sizeof(pattern), &compiler);
+    ret |= err || rex_ast_compile(&compiler, prog, 64);
+    err = rex_build_ast(pattern, sizeof(pattern), &compiler);
+    ret |= err || rex_ast_compile_reverse(&compiler, reverse_prog, 64);
+    for (prog_sz = 1; prog[prog_sz - 1]; prog_sz++);
+    for (reverse_prog_sz = 1; reverse_prog[reverse_prog_sz - 1]; reverse_prog_sz++);
+    /* No submatches in the reverse program */
+    ret |= reverse_prog_sz != prog_sz - 2;
+
+    vm.memory = buffer;
+    vm.memory_sz = 16384;
+    err = rex_vm_reverse(&vm, text, SIZE_MAX, 0, 7, reverse_prog, 
+        reverse_prog_sz, &start, &match);
+    ret |= err || !match || start != 2;
+    err = rex_vm_reverse(&vm, text, SIZE_MAX, 3, 7, reverse_prog, 
+        reverse_prog_sz, &start, &match);
+    ret |= err || match;
+
+    err = rex_dfa_init(&dfa, dfa_buffer, 4096, prog, prog_sz);
+    ret |= err;
+    err = rex_two_phase_search_reverse(&vm, &dfa, reverse_prog, 
+        reverse_prog_sz, text, SIZE_MAX, 0, extract, 2, &match);
+    ret |= err || !match;
+    ret |= extract[0].match != text + 2 || extract[0].match_sz != 5;
+    ret |= extract[1].match != text + 3 || extract[1].match_sz != 3;
+    err = rex_two_phase_search_reverse(&vm, &dfa, reverse_prog, 
+        reverse_prog_sz, text, SIZE_MAX, 3, extract, 1, &match);
+    ret |= err || !match;
+    ret |= extract[0].match != text + 8 || extract[0].match_sz != 3;
+
+    /* The smallest cache rex_dfa_init takes cannot hold the states of a
+     * search, which falls back to the VM alone */
+    for (dfa_sz = 0; rex_dfa_init(&dfa, dfa_buffer, dfa_sz, prog, prog_sz);
+        dfa_sz++);
+    err = rex_two_phase_search_reverse(&vm, &dfa, reverse_prog, 
+        reverse_prog_sz, "xxabbbbxxac", SIZE_MAX, 0, extract, 1, &match);
+    ret |= err || match || extract[0].match;
+    err = rex_two_phase_search_reverse(&vm, &dfa, reverse_prog, 
+        reverse_prog_sz, text, SIZE_MAX, 0, extract, 1, &match);
+    ret |= err || !match;
+    ret |= extract[0].match != text + 2 || extract[0].match_sz != 5;
+
+    printf(
+        "REVERSE PROGRAM: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+/* ERR(\d+) */
+const uint32_t err_digits[11] ={
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'E'), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'R'), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'R'), 
+    REX_INSTRUCTION(REX_OPCODE_SS, 2), 
+    REX_INSTRUCTION(REX_OPCODE_LR, '0' - 1), 
+    REX_INSTRUCTION(REX_OPCODE_HR, 0), 
+    REX_INSTRUCTION(REX_OPCODE_LR, REX_MAX_UNICODE_VAL), 
+    REX_INSTRUCTION(REX_OPCODE_HRA, '9' + 1), 
+    REX_INSTRUCTION(REX_OPCODE_BWP, 4), 
+    REX_INSTRUCTION(REX_OPCODE_SS, 3), 
+    REX_INSTRUCTION(REX_OPCODE_M, 0) 
+};
+
+/* (?:a|b)b?@ex */
+const uint32_t a_or_b_at_ex[9] ={
+    REX_INSTRUCTION(REX_OPCODE_B, 3), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'a'), 
+    REX_INSTRUCTION(REX_OPCODE_J, 4), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'b'), 
+    REX_INSTRUCTION(REX_OPCODE_B, 6), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'b'), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, '@'), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'e'), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'x'), 
+};
+
+static int
+test_literal(void)
+{
+    static char text[10000];
+    static uint8_t buffer[16384];
+    int err = 0;
+    int ret = 0;
+    rex_literal_t literal;
+    rex_instruction_t prog[10];
+    rex_vm_t vm;
+    rex_match_t extract[2];
+    int match;
+
+    err = rex_prog_prefix(err_digits, 11, &literal);
+    ret |= err || literal.sz != 3 || memcmp(literal.str, "ERR", 3) != 0;
+    err = rex_prog_prefix(digits_dash_digits, 16, &literal);
+    ret |= err || literal.sz != 0;
+    err = rex_prog_literal(digits_dash_digits, 16, buffer, 16384, &literal);
+    ret |= err || literal.sz != 1 || literal.lead != SIZE_MAX;
+    memcpy(prog, a_or_b_at_ex, sizeof(a_or_b_at_ex));
+    prog[9] = REX_INSTRUCTION(REX_OPCODE_M, 0);
+    err = rex_prog_literal(prog, 10, buffer, 16384, &literal);
+    ret |= err || literal.sz != 3 || memcmp(literal.str, "@ex", 3) != 0;
+    ret |= literal.lead != 2 || literal.str[literal.rare] != '@';
+
+    /* Candidates past the first search window */
+    memset(text, '.', sizeof(text) - 1);
+    memcpy(text + 5000, "ab@ex", 5);
+    memcpy(text + 9000, "xbb@ex", 6);
+    vm.memory = buffer;
+    vm.memory_sz = 16384;
+    err |= rex_vm_search_literal(&vm, &literal, text, SIZE_MAX, 5005, 
+        prog, 10, extract, 1, &match);
+    ret |= err || !match;
+    ret |= extract[0].match != text + 9001 || extract[0].match_sz != 5;
+    err |= rex_vm_search_literal(&vm, &literal, text, 9005, 5005, 
+        prog, 10, extract, 1, &match);
+    ret |= err || match;
+
+    err |= rex_prog_prefix(err_digits, 11, &literal);
+    memcpy(text + 5000, "ERR-", 4);
+    memcpy(text + 9000, "ERR42", 5);
+    err |= rex_vm_search_literal(&vm, &literal, text, SIZE_MAX, 0, 
+        err_digits, 11, extract, 2, &match);
+    ret |= err || !match;
+    ret |= extract[0].match != text + 9000 || extract[0].match_sz != 5;
+    ret |= extract[1].match != text + 9003 || extract[1].match_sz != 2;
+    err |= rex_vm_search_literal(&vm, &literal, text, 9004, 0, 
+        err_digits, 11, extract, 2, &match);
+    ret |= err || !match || extract[0].match_sz != 4;
+    err |= rex_vm_search_prefix(&vm, &literal, text, 9002, 0, 
+        err_digits, 11, extract, 2, &match);
+    ret |= err || match;
+    text[7000] = 0;
+    err |= rex_vm_search_literal(&vm, &literal, text, SIZE_MAX, 0, 
+        err_digits, 11, extract, 2, &match);
+    ret |= err || match;
+
+    printf(
+        "LITERAL PREFILTER: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+/* she|he|his|hers */
+const uint32_t she_he_his_hers[19] ={
+    REX_INSTRUCTION(REX_OPCODE_B, 5), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 's'), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'h'), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'e'), 
+    REX_INSTRUCTION(REX_OPCODE_J, 18), 
+    REX_INSTRUCTION(REX_OPCODE_B, 9), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'h'), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'e'), 
+    REX_INSTRUCTION(REX_OPCODE_J, 18), 
+    REX_INSTRUCTION(REX_OPCODE_B, 14), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'h'), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'i'), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 's'), 
+    REX_INSTRUCTION(REX_OPCODE_J, 18), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'h'), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'e'), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'r'), 
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 's'), 
+    REX_INSTRUCTION(REX_OPCODE_M, 0) 
+};
+
+static int
+test_aho_corasick(void)
+{
+    static uint8_t buffer[16384];
+    uint8_t vm_buffer[4096];
+    int err = 0;
+    int ret = 0;
+    rex_aho_corasick_t ac;
+    rex_vm_t vm;
+    rex_match_t extract[2];
+    int match;
+
+    vm.memory = vm_buffer;
+    vm.memory_sz = 4096;
+
+    err = rex_aho_corasick_compile(&ac, buffer, 16384, she_he_his_hers, 19);
+    ret |= err || !ac.whole || ac.class_count != 6 || ac.max_depth != 4;
+    err |= rex_aho_corasick_search(&vm, &ac, "ushers", SIZE_MAX, 0, 
+        she_he_his_hers, 19, extract, 1, &match);
+    ret |= err || !match || extract[0].match_sz != 3;
+    ret |= memcmp(extract[0].match, "she", 3) != 0;
+    err |= rex_aho_corasick_search(&vm, &ac, "ushers", SIZE_MAX, 2, 
+        she_he_his_hers, 19, extract, 1, &match);
+    ret |= err || !match || extract[0].match_sz != 2;
+    err |= rex_aho_corasick_search(&vm, &ac, "this", SIZE_MAX, 0, 
+        she_he_his_hers, 19, extract, 1, &match);
+    ret |= err || !match || extract[0].match_sz != 3;
+    err |= rex_aho_corasick_search(&vm, &ac, "hi", SIZE_MAX, 0, 
+        she_he_his_hers, 19, extract, 1, &match);
+    ret |= err || match;
+
+    /* Leftmost first as in the VM */
+    err |= rex_aho_corasick_compile(&ac, buffer, 16384, a_or_ab, 6);
+    ret |= err || !ac.whole;
+    err |= rex_aho_corasick_search(&vm, &ac, "xab", SIZE_MAX, 0, 
+        a_or_ab, 6, extract, 1, &match);
+    ret |= err || !match || extract[0].match_sz != 1;
+
+    /* Prefilter with submatches */
+    err |= rex_aho_corasick_compile(&ac, buffer, 16384, err_digits, 11);
+    ret |= err || ac.whole;
+    err |= rex_aho_corasick_search(&vm, &ac, "ERR ERRx ERR12", SIZE_MAX, 0, 
+        err_digits, 11, extract, 2, &match);
+    ret |= err || !match || extract[0].match_sz != 5;
+    ret |= extract[1].match_sz != 2 || memcmp(extract[1].match, "12", 2) != 0;
+
+    ret |= rex_aho_corasick_compile(&ac, buffer, 16384, 
+        digits_dash_digits, 16) != REX_UNSUPPORTED_PROGRAM;
+
+    printf(
+        "AHO-CORASICK: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+static int
+test_teddy(void)
+{
+    static uint8_t buffer[16384];
+    static char text[10001];
+    uint8_t vm_buffer[4096];
+    int err = 0;
+    int ret = 0;
+    rex_aho_corasick_t ac, walk;
+    rex_vm_t vm;
+    rex_match_t extract[2], expect[2];
+    int match, expect_match, level;
+    size_t i;
+
+    vm.memory = vm_buffer;
+    vm.memory_sz = 4096;
+
+    /* Near misses of the arms in every block and across the windows */
+    for (i = 0; i < 10000; i++) text[i] = "hsierx"[(i * 7 + i / 13) % 6];
+    text[10000] = 0;
+
+    err = rex_aho_corasick_compile(&ac, buffer, 16384, she_he_his_hers, 19);
+    walk = ac;
+    walk.teddy = REX_SIMD_NONE;
+    ret |= err || (ac.teddy != REX_SIMD_NONE && ac.teddy_sz != 2);
+    /* Every scanner the machine has against the table walk */
+    for (level = ac.teddy; level != REX_SIMD_NONE; level--)
+    {
+        ac.teddy = level;
+        for (i = 0; i < 10000 && !ret; i += 37)
+        {
+            err |= rex_aho_corasick_search(&vm, &ac, text, 10000 - i % 5, i, 
+                she_he_his_hers, 19, extract, 1, &match);
+            err |= rex_aho_corasick_search(&vm, &walk, text, 10000 - i % 5, i, 
+                she_he_his_hers, 19, expect, 1, &expect_match);
+            ret |= err || match != expect_match;
+            ret |= match && extract[0].match != expect[0].match;
+            ret |= match && extract[0].match_sz != expect[0].match_sz;
+        }
+    }
+    ac.teddy = rex_simd_level();
+
+    /* Cut by the terminator */
+    text[5000] = 0;
+    err |= rex_aho_corasick_search(&vm, &ac, text, SIZE_MAX, 4990, 
+        she_he_his_hers, 19, extract, 1, &match);
+    ret |= err || (match && extract[0].match + extract[0].match_sz > text + 5000);
+    text[5000] = 'x';
+
+    /* Prefilter */
+    err |= rex_aho_corasick_compile(&ac, buffer, 16384, err_digits, 11);
+    memset(text, 'E', 10000);
+    memcpy(text + 9990, "ERR1", 4);
+    err |= rex_aho_corasick_search(&vm, &ac, text, SIZE_MAX, 0, 
+        err_digits, 11, extract, 2, &match);
+    ret |= err || !match || extract[0].match != text + 9990;
+    ret |= extract[1].match_sz != 1;
+
+    printf(
+        "TEDDY: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+static int
+test_ascii_run(void)
+{
+    static char text[601];
+    uint8_t vm_buffer[4096];
+    size_t checked;
+    int err = 0;
+    int ret = 0;
+    rex_vm_t vm;
+    rex_match_t extract[1];
+    int match, level;
+
+    vm.memory = vm_buffer;
+    vm.memory_sz = 4096;
+
+    memset(text, 'a', 600);
+    memcpy(text + 299, "\xe2\x98\x80", 3);
+    text[350] = 0;
+    text[600] = 0;
+
+    for (level = rex_simd_level(); level >= REX_SIMD_NONE; level--)
+    {
+        ret |= rex_ascii_run(level, text, SIZE_MAX, 0, NULL) != 
+            REX_ASCII_WINDOW;
+        ret |= rex_ascii_run(level, text, SIZE_MAX, 100, NULL) != 199;
+        ret |= rex_ascii_run(level, text, 250, 100, NULL) != 150;
+        ret |= rex_ascii_run(level, text, SIZE_MAX, 299, NULL) != 0;
+        ret |= rex_ascii_run(level, text, SIZE_MAX, 302, NULL) != 48;
+        ret |= rex_ascii_run(level, text, 300, 300, NULL) != 0;
+
+        /* Runs within the bytes checked for the terminator end with them */
+        checked = 0;
+        ret |= rex_ascii_run(level, text, SIZE_MAX, 302, &checked) != 48;
+        ret |= checked != 350;
+        ret |= rex_ascii_run(level, text, SIZE_MAX, 320, &checked) != 30;
+        ret |= rex_ascii_run(level, text, SIZE_MAX, 350, &checked) != 0;
+        ret |= rex_ascii_run(level, text, SIZE_MAX, 351, &checked) != 249;
+        ret |= checked != 600;
+    }
+
+    /* The decoder takes over after the run */
+    err = rex_vm_search(&vm, text, SIZE_MAX, 0, 
+        unicode_misc_symbols, 6, extract, 1, &match);
+    ret |= err || !match || extract[0].match != text + 299;
+    ret |= extract[0].match_sz != 3;
+
+    printf(
+        "ASCII RUN: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+/* [a-☃] reaches across three encoding lengths */
+rex_instruction_t a_to_snowman[] ={
+    REX_INSTRUCTION(REX_OPCODE_LR, 'a'-1), 
+    REX_INSTRUCTION(REX_OPCODE_HR, 0), 
+    REX_INSTRUCTION(REX_OPCODE_LR, REX_MAX_UNICODE_VAL), 
+    REX_INSTRUCTION(REX_OPCODE_HRA, 0x2603+1), 
+    REX_INSTRUCTION(REX_OPCODE_M, 0)
+};
+
+/* \B alone */
+rex_instruction_t lone_not_word_boundary[] ={
+    REX_INSTRUCTION(REX_OPCODE_ANWB, 0), 
+    REX_INSTRUCTION(REX_OPCODE_M, 0)
+};
+
+/* Jumps into the middle of the [b] chain */
+rex_instruction_t jump_into_chain[] ={
+    REX_INSTRUCTION(REX_OPCODE_J, 2), 
+    REX_INSTRUCTION(REX_OPCODE_LR, 'b'), 
+    REX_INSTRUCTION(REX_OPCODE_HRA, 'b'), 
+    REX_INSTRUCTION(REX_OPCODE_M, 0)
+};
+
+int
+test_bytes(void)
+{
+    char text[] = "A\xc3\xa9 \xe2\x98\x83\xe2\x98\x84" "a\xe2\x98\x80z";
+    const char * const boundaries = "a\xc3\xa9" "ba-a";
+    uint8_t memory[256];
+    uint8_t vm_buffer[16384];
+    uint8_t dfa_buffer[8192];
+    uint8_t table_buffer[8192];
+    rex_instruction_t symbols[64], range[64];
+    size_t symbols_sz = 64, range_sz = 64;
+    size_t cpi, end, vm_end, sz;
+    int err = 0;
+    int ret = 0;
+    rex_vm_t vm;
+    rex_dfa_t dfa;
+    rex_dfa_table_t table;
+    rex_match_t extract, vm_extract;
+    int match, vm_match;
+
+    vm.memory = vm_buffer;
+    vm.memory_sz = 16384;
+
+    err = rex_prog_bytes(unicode_misc_symbols, 6, memory, 256,
+        symbols, &symbols_sz);
+    ret |= err;
+    err = rex_prog_bytes(a_to_snowman, 5, memory, 256, NULL, &sz);
+    ret |= err;
+    err = rex_prog_bytes(a_to_snowman, 5, memory, 256, range, &range_sz);
+    ret |= err || range_sz != sz;
+
+    /* Finds what the codepoint program finds */
+    err = rex_vm_search_bytes(&vm, text, SIZE_MAX, 0, symbols, symbols_sz,
+        &extract, 1, &match);
+    ret |= err || !match;
+    ret |= extract.match != text + 4 || extract.match_sz != 6;
+    for (cpi = 0; text[cpi] && !ret; cpi++)
+    {
+        /* Only a codepoint boundary can start a codepoint */
+        err = rex_vm_exec_bytes(&vm, text, SIZE_MAX, cpi, range, range_sz,
+            &extract, 1, &match);
+        ret |= err;
+        if ((text[cpi] & REX_UTF8_TAIL_BYTE_LEADING_BITMASK) != 
+            REX_UTF8_BYTE_MOST_SIGNIFICANT_BIT)
+        {
+            err = rex_vm_exec(&vm, text, SIZE_MAX, cpi, a_to_snowman, 5,
+                &vm_extract, 1, &vm_match);
+            ret |= err || match != vm_match;
+            ret |= match && extract.match_sz != vm_extract.match_sz;
+        }else ret |= match;
+    }
+
+    /* As do the lazy DFA and its table */
+    err = rex_dfa_init_bytes(&dfa, dfa_buffer, 8192, range, range_sz);
+    ret |= err;
+    for (cpi = 0; text[cpi] && !ret; cpi++)
+    {
+        err = rex_dfa_search(&dfa, text, SIZE_MAX, cpi, &end, &match);
+        ret |= err;
+        err = rex_vm_search_bytes(&vm, text, SIZE_MAX, cpi, range, range_sz,
+            &vm_extract, 1, &vm_match);
+        ret |= err || match != vm_match;
+        vm_end = vm_extract.match - text + vm_extract.match_sz;
+        ret |= match && end != vm_end;
+    }
+    err = rex_dfa_table_compile(&table, table_buffer, 8192, &dfa, 64);
+    ret |= err;
+    for (cpi = 0; text[cpi] && !ret; cpi++)
+    {
+        err = rex_dfa_table_exec(&table, text, SIZE_MAX, cpi, &match);
+        ret |= err;
+        err = rex_vm_exec_bytes(&vm, text, SIZE_MAX, cpi, range, range_sz,
+            &extract, 1, &vm_match);
+        ret |= err || match != vm_match;
+    }
+
+    /* Empty matches are not found inside a codepoint */
+    sz = 64;
+    err = rex_prog_bytes(lone_not_word_boundary, 2, memory, 256, range, &sz);
+    ret |= err;
+    err = rex_vm_search(&vm, boundaries, SIZE_MAX, 0, 
+        lone_not_word_boundary, 2, &vm_extract, 1, &vm_match);
+    ret |= err || !vm_match || vm_extract.match != boundaries + 4;
+    for (cpi = 0; cpi < 2 && !ret; cpi++)
+    {
+        /* The backtracker then the VM */
+        vm.memory_sz = cpi ? rex_vm_memory_sz(sz, 1) : 16384;
+        err = rex_vm_search_bytes(&vm, boundaries, SIZE_MAX, 0, range, sz,
+            &extract, 1, &match);
+        ret |= err || !match || extract.match != vm_extract.match;
+        ret |= extract.match_sz != 0;
+    }
+    vm.memory_sz = 16384;
+    err = rex_dfa_init_bytes(&dfa, dfa_buffer, 8192, range, sz);
+    ret |= err;
+    err = rex_dfa_search(&dfa, boundaries, SIZE_MAX, 0, &end, &match);
+    ret |= err || !match || end != 4;
+
+    /* Chains are rewritten whole */
+    sz = 64;
+    ret |= rex_prog_bytes(jump_into_chain, 4, memory, 256, range, &sz) 
+        != REX_UNSUPPORTED_PROGRAM;
+    sz = 2;
+    ret |= rex_prog_bytes(a_to_snowman, 5, memory, 256, range, &sz) 
+        != REX_OUT_OF_MEMORY;
+
+    printf(
+        "BYTE PROGRAM: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+/* [A-Za-z0-9_.-]+@ */
+rex_instruction_t name_then_at[] ={
+    REX_INSTRUCTION(REX_OPCODE_LR, ','), 
+    REX_INSTRUCTION(REX_OPCODE_HR, 0), 
+    REX_INSTRUCTION(REX_OPCODE_HI, '/'), 
+    REX_INSTRUCTION(REX_OPCODE_LR, '@'), 
+    REX_INSTRUCTION(REX_OPCODE_HR, ':'), 
+    REX_INSTRUCTION(REX_OPCODE_LR, '^'), 
+    REX_INSTRUCTION(REX_OPCODE_HR, '['), 
+    REX_INSTRUCTION(REX_OPCODE_HI, '`'), 
+    REX_INSTRUCTION(REX_OPCODE_LR, REX_MAX_UNICODE_VAL), 
+    REX_INSTRUCTION(REX_OPCODE_HRA, '{'), 
+    REX_INSTRUCTION(REX_OPCODE_BWP, 0),
+    REX_INSTRUCTION(REX_OPCODE_HNIA, '@'),
+    REX_INSTRUCTION(REX_OPCODE_M, 0)
+};
+
+int
+test_sets(void)
+{
+    const char * texts[] = {
+        "mail: jo.smith-2@x", 
+        "a b@", 
+        "\xe2\x98\x83@ /@", 
+        "no at sign", 
+        "x\xe2\x98\x80\xe2\x98\x81y"
+    };
+    uint8_t memory[1024];
+    uint8_t vm_buffer[4096];
+    uint8_t dfa_buffer[4096];
+    rex_instruction_t name[64], symbols[64], large[512];
+    size_t name_sz = 64, symbols_sz = 64, large_sz = 381, pool_sz, ti, tight;
+    uint32_t cp, next, r0;
+    int err = 0;
+    int ret = 0;
+    rex_vm_t vm;
+    rex_dfa_t dfa;
+    rex_match_t extract, set_extract;
+    int match, set_match;
+
+    err = rex_prog_sets(name_then_at, 13, memory, 256, name, &name_sz, 
+        &pool_sz);
+    ret |= err || name_sz != 4 || pool_sz != REX_SET_SZ(0);
+    ret |= name[0] != REX_INSTRUCTION(REX_OPCODE_HNSA, 0);
+    ret |= name[1] != REX_INSTRUCTION(REX_OPCODE_BWP, 0);
+    err = rex_prog_sets(unicode_misc_symbols, 6, memory, 256, symbols, 
+        &symbols_sz, &pool_sz);
+    ret |= err || symbols_sz != 3 || pool_sz != REX_SET_SZ(1);
+
+    /* The backtracker and the VM agree with the halt chains */
+    for (tight = 0; tight < 2; tight++)
+    {
+        vm.memory = vm_buffer;
+        vm.memory_sz = tight ? rex_vm_memory_sz(13, 1) : 4096;
+        for (ti = 0; ti < sizeof(texts) / sizeof(texts[0]) && !ret; ti++)
+        {
+            err = rex_vm_search(&vm, texts[ti], SIZE_MAX, 0, name_then_at, 
+                13, &extract, 1, &match);
+            ret |= err;
+            err = rex_vm_search(&vm, texts[ti], SIZE_MAX, 0, name, name_sz,
+                &set_extract, 1, &set_match);
+            ret |= err || match != set_match;
+            ret |= match && (extract.match != set_extract.match ||
+                extract.match_sz != set_extract.match_sz);
+            err = rex_vm_search(&vm, texts[ti], SIZE_MAX, 0, 
+                unicode_misc_symbols, 6, &extract, 1, &match);
+            ret |= err;
+            err = rex_vm_search(&vm, texts[ti], SIZE_MAX, 0, symbols, 
+                symbols_sz, &set_extract, 1, &set_match);
+            ret |= err || match != set_match;
+            ret |= match && (extract.match != set_extract.match ||
+                extract.match_sz != set_extract.match_sz);
+        }
+    }
+
+    /* A set of 64 CJK ranges is searched like its halt chain */
+    for (ti = 0, r0 = 0; ti < 64; ti++)
+    {
+        large[ti * 2] = REX_INSTRUCTION(REX_OPCODE_LR, 0x4E00 + ti * 8 - 1);
+        large[ti * 2 + 1] = REX_INSTRUCTION(REX_OPCODE_HR, r0);
+        r0 = 0x4E00 + ti * 8 + 3;
+    }
+    large[128] = REX_INSTRUCTION(REX_OPCODE_LR, REX_MAX_UNICODE_VAL);
+    large[129] = REX_INSTRUCTION(REX_OPCODE_HRA, r0);
+    large[130] = REX_INSTRUCTION(REX_OPCODE_M, 0);
+    err = rex_prog_sets(large, 131, memory, 1024, large + 131, 
+        &large_sz, &pool_sz);
+    ret |= err || large_sz != 2 || pool_sz != REX_SET_SZ(64);
+    for (cp = 0x4DF0; cp < 0x5010 && !ret; cp++)
+    {
+        err = rex_prog_chain_step(large, 131, 0, cp, &next);
+        ret |= err;
+        ret |= rex_set_contains(large + 131 + large_sz, cp) != 
+            (next != REX_PC_HALTED);
+    }
+
+    /* Class based engines keep the halt chains */
+    ret |= rex_dfa_init(&dfa, dfa_buffer, 4096, name, name_sz) 
+        != REX_UNSUPPORTED_PROGRAM;
+    ret |= rex_prog_sets(name, name_sz, memory, 256, NULL, &name_sz, 
+        &pool_sz) != REX_UNSUPPORTED_PROGRAM;
+
+    printf(
+        "SETS: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+/* (a)((?:b|bc)*)(c?)d */
+static const rex_instruction_t captures_in_loop[] = {
+    REX_INSTRUCTION(REX_OPCODE_SS, 2),
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'a'),
+    REX_INSTRUCTION(REX_OPCODE_SS, 3),
+    REX_INSTRUCTION(REX_OPCODE_SS, 4),
+    REX_INSTRUCTION(REX_OPCODE_B, 11),
+    REX_INSTRUCTION(REX_OPCODE_B, 8),
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'b'),
+    REX_INSTRUCTION(REX_OPCODE_J, 10),
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'b'),
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'c'),
+    REX_INSTRUCTION(REX_OPCODE_J, 4),
+    REX_INSTRUCTION(REX_OPCODE_SS, 5),
+    REX_INSTRUCTION(REX_OPCODE_SS, 6),
+    REX_INSTRUCTION(REX_OPCODE_B, 15),
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'c'),
+    REX_INSTRUCTION(REX_OPCODE_SS, 7),
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'd'),
+    REX_INSTRUCTION(REX_OPCODE_M, 0),
+};
+
+int
+test_capture_slots(void)
+{
+    const char * texts[] = {"abbcbcd", "abcbd", "abd", "abbbbbbbbcd"};
+    /* Offset and size of every group of texts[i] */
+    const size_t expected[][8] = {
+        {0, 7, 0, 1, 1, 4, 5, 1},
+        {0, 5, 0, 1, 1, 3, 4, 0},
+        {0, 3, 0, 1, 1, 1, 2, 0},
+        {0, 11, 0, 1, 1, 8, 9, 1},
+    };
+    uint8_t vm_buffer[4096];
+    size_t ti, gi, tight;
+    int err = 0;
+    int ret = 0;
+    rex_vm_t vm;
+    rex_match_t matches[4];
+    int match;
+
+    /* Threads share their slots, so the smallest memory must do */
+    for (tight = 0; tight < 2; tight++)
+    {
+        vm.memory = vm_buffer;
+        vm.memory_sz = tight ? rex_vm_memory_sz(18, 4) : 4096;
+        for (ti = 0; ti < sizeof(texts) / sizeof(texts[0]) && !ret; ti++)
+        {
+            err = rex_vm_exec(&vm, texts[ti], SIZE_MAX, 0, captures_in_loop,
+                18, matches, 4, &match);
+            ret |= err || !match;
+            for (gi = 0; gi < 4 && !ret; gi++)
+                ret |= matches[gi].match != texts[ti] + expected[ti][gi * 2] ||
+                    matches[gi].match_sz != expected[ti][gi * 2 + 1];
+        }
+        err = rex_vm_exec(&vm, "abcbcbx", SIZE_MAX, 0, captures_in_loop,
+            18, matches, 4, &match);
+        ret |= err || match;
+    }
+
+    /* Only the match is extracted, the groups are not saved */
+    vm.memory_sz = rex_vm_memory_sz(18, 1);
+    for (ti = 0; ti < sizeof(texts) / sizeof(texts[0]) && !ret; ti++)
+    {
+        err = rex_vm_exec(&vm, texts[ti], SIZE_MAX, 0, captures_in_loop,
+            18, matches, 1, &match);
+        ret |= err || !match;
+        ret |= matches[0].match != texts[ti] + expected[ti][0] ||
+            matches[0].match_sz != expected[ti][1];
+    }
+
+    printf(
+        "CAPTURE SLOTS: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+int
+test_stream(void)
+{
+    const char text[] = 
+        "two \xe2\x98\x83\xe2\x98\x81 words, abbcbcd, jo.smith@x abcbd "
+        "\xe2\x98\x80 end";
+    const size_t chunks[] = {1, 2, 3, 5, 7, 64};
+    const rex_instruction_t * progs[] = {
+        unicode_misc_symbols, 
+        word_boundary, 
+        name_then_at, 
+        captures_in_loop
+    };
+    const size_t progs_sz[] = {6, 9, 13, 18};
+    uint8_t vm_buffer[4096];
+    uint8_t stream_buffer[4096];
+    size_t pi, ci, pos, n, mi, text_sz = sizeof(text) - 1;
+    int err = 0;
+    int ret = 0;
+    rex_vm_t vm;
+    rex_vm_stream_t stream;
+    rex_match_t matches[4];
+    rex_stream_match_t stream_matches[4];
+    int match, stream_match;
+
+    vm.memory = vm_buffer;
+    vm.memory_sz = 4096;
+    /* A stream matches like the whole text whichever way it is cut */
+    for (pi = 0; pi < 4 && !ret; pi++)
+    {
+        /* The capture program is searched from one of its matches */
+        err = rex_vm_search(&vm, text, text_sz, 0, progs[pi], progs_sz[pi], 
+            matches, 4, &match);
+        ret |= err || !match;
+        for (ci = 0; ci < sizeof(chunks) / sizeof(chunks[0]) && !ret; ci++)
+        {
+            err = rex_vm_stream_begin(&stream, stream_buffer, 4096, 
+                progs[pi], progs_sz[pi], stream_matches, 4, 
+                REX_VM_UNANCHORED);
+            for (pos = 0; pos < text_sz && !err; pos += n)
+            {
+                n = text_sz - pos < chunks[ci] ? text_sz - pos : chunks[ci];
+                err = rex_vm_stream_feed(&stream, text + pos, n);
+            }
+            if (!err) err = rex_vm_stream_end(&stream, &stream_match);
+            ret |= err || !stream_match;
+            for (mi = 0; mi < 4 && !ret; mi++)
+                ret |= matches[mi].match ? 
+                    stream_matches[mi].offset != 
+                        (size_t)(matches[mi].match - text) ||
+                    stream_matches[mi].match_sz != matches[mi].match_sz :
+                    stream_matches[mi].offset != SIZE_MAX;
+        }
+    }
+
+    /* Anchored, a stream shorter than a codepoint and a halted stream */
+    err = rex_vm_stream_begin(&stream, stream_buffer, 4096, 
+        captures_in_loop, 18, stream_matches, 1, 0);
+    ret |= err;
+    err = rex_vm_stream_feed(&stream, "abd", 3);
+    if (!err) err = rex_vm_stream_end(&stream, &stream_match);
+    ret |= err || !stream_match;
+    ret |= stream_matches[0].offset != 0 || stream_matches[0].match_sz != 3;
+    err = rex_vm_stream_begin(&stream, stream_buffer, 4096, 
+        captures_in_loop, 18, stream_matches, 1, 0);
+    ret |= err;
+    err = rex_vm_stream_feed(&stream, "x", 1);
+    if (!err) err = rex_vm_stream_feed(&stream, "abd", 3);
+    if (!err) err = rex_vm_stream_end(&stream, &stream_match);
+    ret |= err || stream_match;
+    ret |= rex_vm_stream_feed(&stream, "abd", 3) != REX_BAD_PARAM;
+    ret |= rex_vm_stream_begin(&stream, stream_buffer, 16, captures_in_loop, 
+        18, stream_matches, 1, 0) != REX_OUT_OF_MEMORY;
+
+    printf(
+        "STREAM: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+/* a* */
+rex_instruction_t a_star[] = {
+    REX_INSTRUCTION(REX_OPCODE_B, 3),
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'a'),
+    REX_INSTRUCTION(REX_OPCODE_J, 0),
+    REX_INSTRUCTION(REX_OPCODE_M, 0)
+};
+
+int
+test_find_iter(void)
+{
+    const char * text = "abd, abcbd x abbcbcd";
+    const char * empty_text = "baab";
+    /* Offset and size of every match of a* in empty_text */
+    const size_t expected[] = {0, 0, 1, 2, 4, 0};
+    /* Same for a byte program, which steps over a whole codepoint */
+    const char * bytes_text = "\xc3\xa9" "aa";
+    const size_t bytes_expected[] = {0, 0, 2, 2};
+    rex_instruction_t bytes_prog[16];
+    size_t bytes_prog_sz = 16;
+    uint8_t vm_buffer[4096];
+    uint8_t iter_buffer[4096];
+    size_t count = 0, pos = 0, mi;
+    int err = 0;
+    int ret = 0;
+    rex_vm_t vm;
+    rex_vm_find_iter_t iter;
+    rex_match_t matches[4], iter_matches[4];
+    int match, iter_match;
+
+    /* Every match is the one a search from the end of the last finds */
+    vm.memory = vm_buffer;
+    vm.memory_sz = 4096;
+    err = rex_vm_find_iter_begin(&iter, iter_buffer, 4096, text, SIZE_MAX, 0,
+        captures_in_loop, 18, iter_matches, 4, 0);
+    ret |= err;
+    while (!ret)
+    {
+        err = rex_vm_find_iter_next(&iter, &iter_match);
+        ret |= err;
+        err = rex_vm_search(&vm, text, SIZE_MAX, pos, captures_in_loop, 18,
+            matches, 4, &match);
+        ret |= err || match != iter_match;
+        if (ret || !match) break;
+        for (mi = 0; mi < 4; mi++)
+            ret |= matches[mi].match != iter_matches[mi].match ||
+                matches[mi].match_sz != iter_matches[mi].match_sz;
+        pos = matches[0].match - text + matches[0].match_sz;
+        count++;
+    }
+    ret |= count != 3;
+
+    /* Empty matches move on and none follows the match before it */
+    err = rex_vm_find_iter_begin(&iter, iter_buffer, rex_vm_memory_sz(4, 1),
+        empty_text, 4, 0, a_star, 4, iter_matches, 1, 0);
+    ret |= err;
+    for (count = 0; count < 4 && !ret; count++)
+    {
+        err = rex_vm_find_iter_next(&iter, &iter_match);
+        ret |= err;
+        if (count == 3)
+        {
+            ret |= iter_match;
+            break;
+        }
+        ret |= !iter_match || 
+            iter_matches[0].match != empty_text + expected[count * 2] ||
+            iter_matches[0].match_sz != expected[count * 2 + 1];
+    }
+
+    err = rex_prog_bytes(a_star, 4, vm_buffer, 4096, bytes_prog, 
+        &bytes_prog_sz);
+    ret |= err;
+    err = rex_vm_find_iter_begin(&iter, iter_buffer, 4096, bytes_text, 
+        SIZE_MAX, 0, bytes_prog, bytes_prog_sz, iter_matches, 1, 
+        REX_VM_BYTES);
+    ret |= err;
+    for (count = 0; count < 3 && !ret; count++)
+    {
+        err = rex_vm_find_iter_next(&iter, &iter_match);
+        ret |= err;
+        if (count == 2)
+        {
+            ret |= iter_match;
+            break;
+        }
+        ret |= !iter_match || 
+            iter_matches[0].match != bytes_text + bytes_expected[count * 2] ||
+            iter_matches[0].match_sz != bytes_expected[count * 2 + 1];
+    }
+
+    printf(
+        "FIND ITERATOR: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+/* x(?:a|b)*[0-9a-f] as a compiler might leave it */
+rex_instruction_t wasteful[] = {
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'x'),
+    REX_INSTRUCTION(REX_OPCODE_B, 7),
+    REX_INSTRUCTION(REX_OPCODE_B, 5),
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'a'),
+    REX_INSTRUCTION(REX_OPCODE_J, 6),
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'b'),
+    REX_INSTRUCTION(REX_OPCODE_J, 1),
+    REX_INSTRUCTION(REX_OPCODE_J, 8),
+    REX_INSTRUCTION(REX_OPCODE_LR, '/'),
+    REX_INSTRUCTION(REX_OPCODE_HR, 0),
+    REX_INSTRUCTION(REX_OPCODE_LR, '`'),
+    REX_INSTRUCTION(REX_OPCODE_HR, ':'),
+    REX_INSTRUCTION(REX_OPCODE_LR, '`'),
+    REX_INSTRUCTION(REX_OPCODE_HR, '<'),
+    REX_INSTRUCTION(REX_OPCODE_LR, REX_MAX_UNICODE_VAL),
+    REX_INSTRUCTION(REX_OPCODE_HRA, 'g'),
+    REX_INSTRUCTION(REX_OPCODE_J, 18),
+    REX_INSTRUCTION(REX_OPCODE_HNIA, 'q'),
+    REX_INSTRUCTION(REX_OPCODE_M, 0)
+};
+
+int
+test_optimize(void)
+{
+    const rex_instruction_t expected[] = {
+        REX_INSTRUCTION(REX_OPCODE_HNIA, 'x'),
+        REX_INSTRUCTION(REX_OPCODE_B, 7),
+        REX_INSTRUCTION(REX_OPCODE_B, 5),
+        REX_INSTRUCTION(REX_OPCODE_HNIA, 'a'),
+        REX_INSTRUCTION(REX_OPCODE_J, 1),
+        REX_INSTRUCTION(REX_OPCODE_HNIA, 'b'),
+        REX_INSTRUCTION(REX_OPCODE_J, 1),
+        REX_INSTRUCTION(REX_OPCODE_LR, '/'),
+        REX_INSTRUCTION(REX_OPCODE_HR, 0),
+        REX_INSTRUCTION(REX_OPCODE_LR, '`'),
+        REX_INSTRUCTION(REX_OPCODE_HR, ':'),
+        REX_INSTRUCTION(REX_OPCODE_LR, REX_UTF8_CODEPOINT_MAX),
+        REX_INSTRUCTION(REX_OPCODE_HRA, 'g'),
+        REX_INSTRUCTION(REX_OPCODE_M, 0)
+    };
+    const char * texts[] = {"xabba7", "xf", "xab:", "xq", "yx0", "xbag"};
+    const rex_instruction_t out_of_range[] = {
+        REX_INSTRUCTION(REX_OPCODE_J, 3),
+        REX_INSTRUCTION(REX_OPCODE_M, 0)
+    };
+    uint32_t memory[REX_PROG_OPTIMIZE_MEMORY_SZ(19) / sizeof(uint32_t)];
+    uint8_t vm_buffer[4096];
+    rex_instruction_t optimized[19];
+    size_t optimized_sz = 19, size_only, ti, pc;
+    int err = 0;
+    int ret = 0;
+    rex_vm_t vm;
+    rex_match_t extract, optimized_extract;
+    int match, optimized_match;
+
+    err = rex_prog_optimize(wasteful, 19, memory, sizeof(memory), 
+        optimized, &optimized_sz);
+    ret |= err || optimized_sz != sizeof(expected) / sizeof(expected[0]);
+    for (pc = 0; pc < optimized_sz && !ret; pc++)
+        ret |= optimized[pc] != expected[pc];
+    ret |= rex_prog_optimize(wasteful, 19, memory, sizeof(memory), 
+        NULL, &size_only) || size_only != optimized_sz;
+
+    vm.memory = vm_buffer;
+    vm.memory_sz = sizeof(vm_buffer);
+    for (ti = 0; ti < sizeof(texts) / sizeof(texts[0]) && !ret; ti++)
+    {
+        err = rex_vm_search(&vm, texts[ti], SIZE_MAX, 0, wasteful, 19,
+            &extract, 1, &match);
+        ret |= err;
+        err = rex_vm_search(&vm, texts[ti], SIZE_MAX, 0, optimized, 
+            optimized_sz, &optimized_extract, 1, &optimized_match);
+        ret |= err || match != optimized_match;
+        ret |= match && (extract.match != optimized_extract.match ||
+            extract.match_sz != optimized_extract.match_sz);
+    }
+
+    /* The program must fit and its jumps must stay inside it */
+    optimized_sz = 4;
+    ret |= rex_prog_optimize(wasteful, 19, memory, sizeof(memory), 
+        optimized, &optimized_sz) != REX_OUT_OF_MEMORY;
+    ret |= rex_prog_optimize(out_of_range, 2, memory, sizeof(memory), 
+        NULL, &size_only) != REX_UNSUPPORTED_PROGRAM;
+
+    printf(
+        "OPTIMIZE: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+int
+test_closures(void)
+{
+    const char * texts[] = {"abbcbcd", "abcbd", "x abd", "abbbbbbbbcd", ""};
+    const rex_instruction_t * progs[] = {captures_in_loop, word_boundary};
+    const size_t progs_sz[] = {18, 9};
+    uint32_t closures_buffer[1024];
+    uint8_t vm_buffer[4096];
+    uint32_t start_count;
+    size_t ti, pi, gi, matches_sz;
+    int err = 0;
+    int ret = 0;
+    rex_vm_t vm;
+    rex_closures_t closures;
+    rex_match_t matches[4], closure_matches[4];
+    int match, closure_match;
+
+    /* The VM runs, not the backtracker, when memory is tight */
+    vm.memory = vm_buffer;
+    for (pi = 0; pi < 2 && !ret; pi++)
+    {
+        err = rex_closures_compile(&closures, closures_buffer, 
+            sizeof(closures_buffer), progs[pi], progs_sz[pi]);
+        ret |= err;
+        ret |= closures.facts != (pi ? REX_CLOSURES_FACT_BOUNDARY : 0);
+        matches_sz = pi ? 1 : 4;
+        vm.memory_sz = rex_vm_memory_sz(progs_sz[pi], matches_sz);
+        for (ti = 0; ti < sizeof(texts) / sizeof(texts[0]) && !ret; ti++)
+        {
+            err = rex_vm_search(&vm, texts[ti], SIZE_MAX, 0, progs[pi], 
+                progs_sz[pi], matches, matches_sz, &match);
+            ret |= err;
+            err = rex_vm_search_closures(&vm, &closures, texts[ti], 
+                SIZE_MAX, 0, progs[pi], progs_sz[pi], closure_matches, 
+                matches_sz, &closure_match);
+            ret |= err || match != closure_match;
+            for (gi = 0; gi < matches_sz && match && !ret; gi++)
+                ret |= matches[gi].match != closure_matches[gi].match ||
+                    matches[gi].match_sz != closure_matches[gi].match_sz;
+        }
+    }
+
+    /* The start threads are copied from the closure of their context */
+    for (ti = 0; ti <= 5 && !ret; ti++)
+    {
+        err = rex_vm_exec(&vm, texts[2], SIZE_MAX, ti, word_boundary, 9,
+            matches, 1, &match);
+        ret |= err;
+        err = rex_vm_exec_closures(&vm, &closures, texts[2], SIZE_MAX, ti,
+            word_boundary, 9, closure_matches, 1, &closure_match);
+        ret |= err || match != closure_match;
+        ret |= match && (matches[0].match != closure_matches[0].match ||
+            matches[0].match_sz != closure_matches[0].match_sz);
+    }
+
+    /* The closures belong to the program they were compiled for */
+    ret |= rex_vm_exec_closures(&vm, &closures, texts[0], SIZE_MAX, 0,
+        captures_in_loop, 18, matches, 4, &match) != REX_BAD_PARAM;
+    ret |= rex_closures_compile(&closures, closures_buffer, 
+        sizeof(uint32_t) * 18 * 5, captures_in_loop, 18) != REX_OUT_OF_MEMORY;
+
+    /* Runs with closures stay on the VM with memory to spare, an empty
+     * closure of pc 0 leaves no thread to start from or add */
+    vm.memory_sz = sizeof(vm_buffer);
+    err = rex_closures_compile(&closures, closures_buffer, 
+        sizeof(closures_buffer), captures_in_loop, 18);
+    ret |= err;
+    start_count = closures.closures[closures.index[0]];
+    closures.closures[closures.index[0]] = 0;
+    err = rex_vm_exec_closures(&vm, &closures, texts[0], SIZE_MAX, 0,
+        captures_in_loop, 18, closure_matches, 4, &closure_match);
+    ret |= err || closure_match;
+    err = rex_vm_search_closures(&vm, &closures, texts[2], SIZE_MAX, 0,
+        captures_in_loop, 18, closure_matches, 4, &closure_match);
+    ret |= err || closure_match;
+    closures.closures[closures.index[0]] = start_count;
+    err = rex_vm_search_closures(&vm, &closures, texts[2], SIZE_MAX, 0,
+        captures_in_loop, 18, closure_matches, 4, &closure_match);
+    ret |= err || !closure_match;
+
+    printf(
+        "CLOSURES: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
+int
+test_decoded_program(void)
+{
+    /* abe, changed in place to ace */
+    rex_instruction_t prog[4] = {
+        REX_INSTRUCTION(REX_OPCODE_HNIA, 'a'),
+        REX_INSTRUCTION(REX_OPCODE_HNIA, 'b'),
+        REX_INSTRUCTION(REX_OPCODE_HNIA, 'e'),
+        REX_INSTRUCTION(REX_OPCODE_M, 0)
+    };
+    static uint8_t buffer[1024];
+    static uint8_t ops_buffer[256];
+#ifdef REX_VM_THREADED
+    /* The decoded program is aligned within any memory */
+    const size_t offsets = 2;
+#else
+    const size_t offsets = 1;
+#endif
+    size_t offset;
+    int err = 0;
+    int ret = 0;
+    rex_vm_t vm;
+    rex_vm_ops_t ops;
+    rex_match_t extract;
+    int match;
+
+    vm.memory = buffer;
+    vm.memory_sz = sizeof(buffer);
+    for (offset = 0; offset < offsets && !ret; offset++)
+    {
+        err = rex_vm_ops_compile(&ops, ops_buffer + offset, 
+            sizeof(ops_buffer) - offset, prog, 4);
+        ret |= err;
+        err = rex_vm_exec_ops(&vm, &ops, "abe", SIZE_MAX, 0, prog, 4, 
+            &extract, 1, &match);
+        ret |= err || !match || extract.match_sz != 3;
+        err = rex_vm_exec_ops(&vm, &ops, "ace", SIZE_MAX, 0, prog, 4, 
+            &extract, 1, &match);
+        ret |= err || match;
+        err = rex_vm_search_ops(&vm, &ops, "xabe", SIZE_MAX, 0, prog, 4, 
+            &extract, 1, &match);
+        ret |= err || !match || strcmp(extract.match, "abe") != 0;
+    }
+
+    /* Other runs decode the program as it is when they start */
+    prog[1] = REX_INSTRUCTION(REX_OPCODE_HNIA, 'c');
+    err = rex_vm_exec(&vm, "abe", SIZE_MAX, 0, prog, 4, NULL, 0, &match);
+    ret |= err || match;
+    err = rex_vm_exec(&vm, "ace", SIZE_MAX, 0, prog, 4, NULL, 0, &match);
+    ret |= err || !match;
+    err = rex_vm_ops_compile(&ops, ops_buffer, sizeof(ops_buffer), prog, 4);
+    ret |= err;
+    err = rex_vm_exec_ops(&vm, &ops, "ace", SIZE_MAX, 0, prog, 4, 
+        NULL, 0, &match);
+    ret |= err || !match;
+
+    /* The decoded program belongs to one program */
+    ret |= rex_vm_exec_ops(&vm, &ops, "ace", SIZE_MAX, 0, prog, 3, 
+        NULL, 0, &match) != REX_BAD_PARAM;
+    ret |= rex_vm_search_ops(&vm, NULL, "ace", SIZE_MAX, 0, prog, 4, 
+        NULL, 0, &match) != REX_BAD_PARAM;
+#ifdef REX_VM_THREADED
+    ret |= rex_vm_ops_compile(&ops, ops_buffer, REX_VM_OPS_SZ(4) - 1, 
+        prog, 4) != REX_OUT_OF_MEMORY;
+#endif
+
+    printf(
+        "DECODED PROGRAM: %s",
+        !ret ? "PASS" : "FAIL"
+    );
+    if (err)
+    {
+        printf(" WITH ERROR: %d\n",err); 
+    }else{
+        putchar('\n');
+    }
+    return ret;
+}
+
 /* TODO:
  * Test missing match instruction
  */
@@ -1248,6 +2823,25 @@ int main(int argc, char ** argv)
     ret |= test_alphanumeric_random_sequence_with_submatches();
     ret |= test_start_end_assertions();
     ret |= test_word_boundary_assertions();
+    ret |= test_search();
+    ret |= test_dfa();
+    ret |= test_dfa_table();
+    ret |= test_onepass();
+    ret |= test_backtrack();
+    ret |= test_two_phase();
+    ret |= test_reverse();
+    ret |= test_literal();
+    ret |= test_aho_corasick();
+    ret |= test_teddy();
+    ret |= test_ascii_run();
+    ret |= test_bytes();
+    ret |= test_sets();
+    ret |= test_capture_slots();
+    ret |= test_stream();
+    ret |= test_find_iter();
+    ret |= test_optimize();
+    ret |= test_closures();
+    ret |= test_decoded_program();
     if (ret) goto exit;
 
 exit:
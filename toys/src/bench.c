@@ -0,0 +1,287 @@
+#define REX_IMPLEMENTATION
+#include "rex.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* 
+ * Times the cases quoted when the engines were added
+ * Usage: bench [name], every case runs without a name
+ * Times are CPU time in ms and depend on the machine
+ */
+
+#define MEM_SZ (1 << 22)
+static uint8_t mem[MEM_SZ];
+static uint8_t vm_mem[MEM_SZ];
+
+static double
+ms_since(clock_t start)
+{
+    return (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+/* Room for the VM alone, so the backtracker never runs */
+static void
+vm_init(rex_vm_t * vm, size_t prog_sz)
+{
+    vm->memory = vm_mem;
+    vm->memory_sz = rex_vm_memory_sz(prog_sz, 1);
+}
+
+/* sz bytes drawn from alphabet, NUL terminated */
+static char *
+random_text(size_t sz, const char * alphabet)
+{
+    size_t i, n = strlen(alphabet);
+    char * text = malloc(sz + 1);
+    if (!text) return NULL;
+    for (i = 0; i < sz; i++) text[i] = alphabet[rand() % n];
+    text[sz] = 0;
+    return text;
+}
+
+/* 300 words of 6 random letters as an alternation over 1 MiB of letters */
+static int
+bench_aho_corasick(void)
+{
+    static rex_instruction_t prog[4096];
+    size_t words = 300, jumps[300], sz = 0, text_sz = 1 << 20, i, j, b = 0;
+    rex_aho_corasick_t ac;
+    rex_vm_t vm;
+    rex_match_t m;
+    int f, r;
+    clock_t start;
+    char * text;
+
+    for (i = 0; i < words; i++)
+    {
+        if (i + 1 < words) b = sz++;
+        for (j = 0; j < 6; j++)
+            prog[sz++] = REX_INSTRUCTION(REX_OPCODE_HNIA, 'a' + rand() % 26);
+        if (i + 1 < words)
+        {
+            jumps[i] = sz++;
+            prog[b] = REX_INSTRUCTION(REX_OPCODE_B, sz);
+        }
+    }
+    for (i = 0; i + 1 < words; i++)
+        prog[jumps[i]] = REX_INSTRUCTION(REX_OPCODE_J, sz);
+    prog[sz++] = REX_INSTRUCTION(REX_OPCODE_M, 0);
+    text = random_text(text_sz, "abcdefghijklmnopqrstuvwxyz");
+    if (!text) return 1;
+
+    vm_init(&vm, sz);
+    start = clock();
+    r = rex_vm_search(&vm, text, text_sz, 0, prog, sz, &m, 1, &f);
+    printf("aho_corasick: rex_vm_search %.0f ms", ms_since(start));
+    if (!r) r = rex_aho_corasick_compile(&ac, mem, MEM_SZ, prog, sz);
+    start = clock();
+    if (!r) r = rex_aho_corasick_search(&vm, &ac, text, text_sz, 0, prog, sz,
+        &m, 1, &f);
+    printf(", rex_aho_corasick_search %.0f ms\n", ms_since(start));
+    free(text);
+    return r;
+}
+
+/* [A-Za-z0-9_.-]+@ over 1 MiB, as a halt chain and as a pooled set */
+static int
+bench_sets(void)
+{
+    static const rex_instruction_t prog[] = {
+        REX_INSTRUCTION(REX_OPCODE_LR, ','),
+        REX_INSTRUCTION(REX_OPCODE_HR, 0),
+        REX_INSTRUCTION(REX_OPCODE_HI, '/'),
+        REX_INSTRUCTION(REX_OPCODE_LR, '@'),
+        REX_INSTRUCTION(REX_OPCODE_HR, ':'),
+        REX_INSTRUCTION(REX_OPCODE_LR, '^'),
+        REX_INSTRUCTION(REX_OPCODE_HR, '['),
+        REX_INSTRUCTION(REX_OPCODE_HI, '`'),
+        REX_INSTRUCTION(REX_OPCODE_LR, REX_MAX_UNICODE_VAL),
+        REX_INSTRUCTION(REX_OPCODE_HRA, '{'),
+        REX_INSTRUCTION(REX_OPCODE_BWP, 0),
+        REX_INSTRUCTION(REX_OPCODE_HNIA, '@'),
+        REX_INSTRUCTION(REX_OPCODE_M, 0)
+    };
+    static rex_instruction_t sets[4096];
+    size_t sz = sizeof(prog) / sizeof(prog[0]), sets_sz = 4096, pool_sz;
+    size_t text_sz = 1 << 20;
+    rex_vm_t vm;
+    rex_match_t m;
+    int f, r;
+    clock_t start;
+    char * text = random_text(text_sz, "abcdefghij klmno.pq-rs_tu");
+    if (!text) return 1;
+
+    r = rex_prog_sets(prog, sz, mem, MEM_SZ, sets, &sets_sz, &pool_sz);
+    vm_init(&vm, sz);
+    start = clock();
+    if (!r) r = rex_vm_search(&vm, text, text_sz, 0, prog, sz, &m, 1, &f);
+    printf("sets: halt chain %.0f ms", ms_since(start));
+    vm_init(&vm, sets_sz);
+    start = clock();
+    if (!r) r = rex_vm_search(&vm, text, text_sz, 0, sets, sets_sz, &m, 1, &f);
+    printf(", set %.0f ms\n", ms_since(start));
+    free(text);
+    return r;
+}
+
+/* 
+ * [class]+@ where class is 500 CJK ranges of 20 codepoints, 20 apart
+ * Returns the size of the program written to prog
+ */
+static size_t
+cjk_prog(rex_instruction_t * prog)
+{
+    size_t i, sz = 0;
+    uint32_t gap = 0;
+    for (i = 0; i < 500; i++)
+    {
+        prog[sz++] = REX_INSTRUCTION(REX_OPCODE_LR, 0x4E00 + i * 40 - 1);
+        prog[sz++] = REX_INSTRUCTION(REX_OPCODE_HR, gap);
+        gap = 0x4E00 + i * 40 + 20;
+    }
+    prog[sz++] = REX_INSTRUCTION(REX_OPCODE_LR, REX_MAX_UNICODE_VAL);
+    prog[sz++] = REX_INSTRUCTION(REX_OPCODE_HRA, gap);
+    prog[sz++] = REX_INSTRUCTION(REX_OPCODE_BWP, 0);
+    prog[sz++] = REX_INSTRUCTION(REX_OPCODE_HNIA, '@');
+    prog[sz++] = REX_INSTRUCTION(REX_OPCODE_M, 0);
+    return sz;
+}
+
+/* 64 Ki codepoints around the CJK ranges, 192 KiB of UTF-8 */
+static char *
+cjk_text(size_t * sz)
+{
+    size_t i, n = 1 << 16;
+    char * text = malloc(n * 3 + 1);
+    if (!text) return NULL;
+    for (*sz = 0, i = 0; i < n; i++)
+        *sz += rex_encode_utf8_codepoint(0x4E00 + rand() % 20000, 
+            (uint8_t *)text + *sz);
+    text[*sz] = 0;
+    return text;
+}
+
+/* The CJK class as a halt chain and as a pooled set */
+static int
+bench_cjk(void)
+{
+    static rex_instruction_t prog[2048], sets[4096];
+    size_t sz = cjk_prog(prog), sets_sz = 4096, pool_sz, text_sz;
+    rex_vm_t vm;
+    rex_match_t m;
+    int f, r;
+    clock_t start;
+    char * text = cjk_text(&text_sz);
+    if (!text) return 1;
+
+    r = rex_prog_sets(prog, sz, mem, MEM_SZ, sets, &sets_sz, &pool_sz);
+    vm_init(&vm, sz);
+    start = clock();
+    if (!r) r = rex_vm_search(&vm, text, text_sz, 0, prog, sz, &m, 1, &f);
+    printf("cjk: halt chain %.0f ms", ms_since(start));
+    vm_init(&vm, sets_sz);
+    start = clock();
+    if (!r) r = rex_vm_search(&vm, text, text_sz, 0, sets, sets_sz, &m, 1, &f);
+    printf(", set %.0f ms\n", ms_since(start));
+    free(text);
+    return r;
+}
+
+/* 
+ * The CJK class as a halt chain, compare toys/bin/bench_threaded
+ * built with REX_THREADED_DISPATCH
+ */
+static int
+bench_chain(void)
+{
+    static rex_instruction_t prog[2048];
+    size_t sz = cjk_prog(prog), text_sz;
+    rex_vm_t vm;
+    rex_match_t m;
+    int f, r;
+    clock_t start;
+    char * text = cjk_text(&text_sz);
+    if (!text) return 1;
+
+    vm_init(&vm, sz);
+    start = clock();
+    r = rex_vm_search(&vm, text, text_sz, 0, prog, sz, &m, 1, &f);
+    printf("chain: rex_vm_search %.0f ms\n", ms_since(start));
+    free(text);
+    return r;
+}
+
+/* 
+ * Every [a-z]+ of 4 MiB, by the find iterator and by repeated searches
+ * Both get 64 KiB of VM memory, which each search sets up again
+ */
+static int
+bench_find(void)
+{
+    static const rex_instruction_t prog[] = {
+        REX_INSTRUCTION(REX_OPCODE_LR, '`'),
+        REX_INSTRUCTION(REX_OPCODE_HR, 0),
+        REX_INSTRUCTION(REX_OPCODE_LR, REX_MAX_UNICODE_VAL),
+        REX_INSTRUCTION(REX_OPCODE_HRA, '{'),
+        REX_INSTRUCTION(REX_OPCODE_BWP, 0),
+        REX_INSTRUCTION(REX_OPCODE_M, 0)
+    };
+    size_t sz = sizeof(prog) / sizeof(prog[0]), text_sz = 1 << 22;
+    size_t pos = 0, searched = 0, found = 0;
+    rex_vm_find_iter_t iter;
+    rex_vm_t vm;
+    rex_match_t m;
+    int f, r;
+    clock_t start;
+    char * text = random_text(text_sz, "abcde  ,.");
+    if (!text) return 1;
+
+    vm.memory = vm_mem;
+    vm.memory_sz = 1 << 16;
+    start = clock();
+    while (!(r = rex_vm_search(&vm, text, text_sz, pos, prog, sz, &m, 1, &f)) 
+        && f)
+    {
+        searched++;
+        pos = m.match - text + m.match_sz + (m.match_sz == 0);
+    }
+    printf("find: rex_vm_search %.0f ms", ms_since(start));
+    start = clock();
+    if (!r) r = rex_vm_find_iter_begin(&iter, vm_mem, vm.memory_sz, text, 
+        text_sz, 0, prog, sz, &m, 1, 0);
+    while (!r && !(r = rex_vm_find_iter_next(&iter, &f)) && f) found++;
+    printf(", rex_vm_find_iter_next %.0f ms, %lu matches\n", ms_since(start),
+        (unsigned long)found);
+    free(text);
+    return r || found != searched;
+}
+
+static const struct
+{
+    const char * name;
+    int (*run)(void);
+} benches[] = {
+    {"aho_corasick", bench_aho_corasick},
+    {"sets", bench_sets},
+    {"cjk", bench_cjk},
+    {"find", bench_find},
+    {"chain", bench_chain}
+};
+
+int
+main(int argc, char ** argv)
+{
+    size_t i;
+    int r = 0, ran = 0;
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+    {
+        if (argc > 1 && strcmp(argv[1], benches[i].name)) continue;
+        srand(1);
+        r |= benches[i].run();
+        ran = 1;
+    }
+    if (!ran) fprintf(stderr, "No benchmark named %s\n", argv[1]);
+    return r || !ran;
+}
@@ -0,0 +1,17 @@
+import sys
+
+# usage: byte_rank.py FILE...
+# Ranks bytes by how often they appear in the files, 0 being the rarest
+
+counts = [0] * 256
+for path in sys.argv[1:]:
+    with open(path, "rb") as f:
+        for b in f.read():
+            counts[b] += 1
+
+ranks = [0] * 256
+for rank, b in enumerate(sorted(range(256), key=lambda b: (counts[b], b))):
+    ranks[b] = rank
+
+for i in range(0, 256, 16):
+    print("    " + ", ".join("%3d" % r for r in ranks[i:i + 16]) + ",")